@@ -39,15 +39,8 @@ static inline double max_prefix_size() {
 /// </remarks>
 static inline void prefix_with_ul(const unsigned long prefix,
 	std::string& data) {
-	// insert placeholder for the unsigned long prefix
-	for (size_t i = 0; i < sizeof(unsigned long); i++)
-		data = "x" + data;
-
-	// get buffer
-	char* buffer = (char*)(const char*)data.c_str();
-
-	// replace the placeholder with the unsigned long
-	((unsigned long*)buffer)[0] = prefix;
+	// insert the unsigned long in one go
+	data.insert(0, reinterpret_cast<const char*>(&prefix), sizeof(unsigned long));
 }
 
 /// <summary>
@@ -17,8 +17,10 @@
 #endif
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
+#include <future>
 
 namespace liblec {
 	namespace lecnet {
@@ -39,6 +41,96 @@ namespace liblec {
 			/// </param>
 			void lecnet_api get_host_ips(std::vector<std::string>& ips);
 
+			/// <summary>
+			/// The codecs the data exchanged by the TCP client and servers can be compressed
+			/// with.
+			/// </summary>
+			enum class compression : unsigned char {
+				none = 0,
+
+				/// <summary>
+				/// LZ4, for the least time spent compressing.
+				/// </summary>
+				lz4 = 1,
+
+				/// <summary>
+				/// Zstandard, for the smallest data.
+				/// </summary>
+				zstd = 2,
+			};
+
+			/// <summary>
+			/// Check whether the library was built with a compression codec.
+			/// </summary>
+			///
+			/// <param name="codec">
+			/// The codec.
+			/// </param>
+			///
+			/// <returns>
+			/// Returns true if the codec can be used, else false.
+			/// </returns>
+			bool lecnet_api compression_supported(compression codec);
+
+			/// <summary>
+			/// A dictionary to compress data with, which both the client and the server must
+			/// have.
+			/// </summary>
+			///
+			/// <remarks>
+			/// Zstandard only. A dictionary holds what payloads have in common, so that it
+			/// doesn't have to be sent with each of them, which is what makes it worth
+			/// compressing small payloads that are alike in structure, e.g. records of a few
+			/// hundred bytes; set compression_threshold low enough for them to be compressed.
+			/// </remarks>
+			struct compression_dictionary {
+				/// <summary>
+				/// The ID the client and server know the dictionary by. Must not be 0, and must
+				/// be changed whenever the dictionary's data is.
+				/// </summary>
+				unsigned long id = 0;
+
+				/// <summary>
+				/// The dictionary, e.g. as made by train_compression_dictionary(), or any data
+				/// typical of the payloads.
+				/// </summary>
+				std::string data;
+			};
+
+			/// <summary>
+			/// Train a compression dictionary on samples of the payloads it is meant for, e.g.
+			/// captured from the traffic between the client and the server.
+			/// </summary>
+			///
+			/// <param name="samples">
+			/// The samples. A few thousand payloads are typically enough.
+			/// </param>
+			///
+			/// <param name="capacity">
+			/// The largest the dictionary can be, in bytes. About 100 times smaller than the
+			/// samples altogether is a good place to start, e.g. 110 KB.
+			/// </param>
+			///
+			/// <param name="dictionary">
+			/// The dictionary.
+			/// </param>
+			///
+			/// <param name="error">
+			/// Error information.
+			/// </param>
+			///
+			/// <returns>
+			/// Returns true if successful, else false.
+			/// </returns>
+			///
+			/// <remarks>
+			/// Only available if the library was built with Zstandard's dictionary builder.
+			/// </remarks>
+			bool lecnet_api train_compression_dictionary(const std::vector<std::string>& samples,
+				size_t capacity,
+				std::string& dictionary,
+				std::string& error);
+
 			// Correct usage of the liblec::lecnet::tcp::client class is as follows:
 			//
 			// if (connect()) {
@@ -76,7 +168,7 @@ namespace liblec {
 			//		// send/receive error
 			// }
 			//
-			// 2. Non-blocking method (slower)
+			// 2. Non-blocking method
 			//
 			// std::string send, received;
 			// unsigned long data_id;
@@ -97,6 +189,13 @@ namespace liblec {
 			/// <summary>
 			/// TCP client.
 			/// </summary>
+			///
+			/// <remarks>
+			/// Each request, response and push travels in a frame whose length field also
+			/// carries two flags, so it can be no larger than just under 1 GiB where an unsigned
+			/// long is 32 bits, e.g. on Windows. Larger data isn't sent: the request fails with
+			/// an error, and a server drops the response, which it notes in its log.
+			/// </remarks>
 			class lecnet_api client {
 			public:
 				struct client_params {
@@ -130,6 +229,110 @@ namespace liblec {
 					/// checking data integrity.
 					/// </summary>
 					unsigned long magic_number = 0;
+
+					/// <summary>
+					/// Called whenever the server sends data without being asked for it, i.e.
+					/// through server::send or server::broadcast.
+					/// </summary>
+					///
+					/// <remarks>
+					/// Called through the <see cref="executor"/> if there is one. Otherwise it's
+					/// called on the client thread, so make sure the code is non-blocking, as no
+					/// other data is received until the function returns.
+					/// </remarks>
+					std::function<void(const std::string& data)> on_push;
+
+					/// <summary>
+					/// Called whenever the connection state changes: with true once the client
+					/// has connected, then with false, and the reason if there is one, once the
+					/// connection is lost, including through <see cref="disconnect"/>. If the
+					/// connection attempt fails it's only called with false. An alternative to
+					/// polling <see cref="connecting"/> and <see cref="connected"/>.
+					/// </summary>
+					///
+					/// <remarks>
+					/// The client thread is still exiting when it's called with false, so
+					/// <see cref="connect"/> can't be used from within it, and unless there is an
+					/// <see cref="executor"/> the client must not be destroyed from within it.
+					/// </remarks>
+					std::function<void(bool connected, const std::string& error)> on_connected;
+
+					/// <summary>
+					/// Called with the response to data sent using
+					/// <see cref="send_data_async"/> with a data ID, instead of the response
+					/// being kept for <see cref="get_response"/>. An alternative to polling
+					/// <see cref="sending"/>.
+					/// </summary>
+					std::function<void(unsigned long data_id,
+						const std::string& received)> on_response;
+
+					/// <summary>
+					/// Called when data sent using <see cref="send_data_async"/> with a data ID
+					/// gets no response, e.g. because the request timed out or the connection
+					/// was lost, instead of the error being kept for <see cref="get_response"/>.
+					/// </summary>
+					///
+					/// <remarks>
+					/// If either this or <see cref="on_response"/> is set, neither the response
+					/// nor the error is kept for <see cref="get_response"/>.
+					/// </remarks>
+					std::function<void(unsigned long data_id,
+						const std::string& error)> on_error;
+
+					/// <summary>
+					/// Runs the handlers above, and those given to <see cref="send_data_async"/>,
+					/// e.g. by posting them to the application's own event loop or thread pool.
+					/// If not set, they are called on the client thread, where they must not
+					/// block, as no other data is received until they return.
+					/// </summary>
+					///
+					/// <remarks>
+					/// It's called on the client thread, in the order things happen, so it must
+					/// not block either. The handlers it's given don't refer to the client, so
+					/// they can still be run after the client is destroyed.
+					/// </remarks>
+					std::function<void(std::function<void()> handler)> executor;
+
+					/// <summary>
+					/// The codecs the client can compress data with, in order of preference.
+					/// Leave empty for no compression.
+					/// </summary>
+					///
+					/// <remarks>
+					/// The codec is agreed on with the server as soon as the client connects,
+					/// out of those the server has in server_params::compression_codecs, and
+					/// data is only compressed once it has been agreed on. The server must be
+					/// built with this version of the library or later. Responses are
+					/// decompressed on the thread that collects them, not on the client
+					/// thread.
+					/// </remarks>
+					std::vector<compression> compression_codecs;
+
+					/// <summary>
+					/// The smallest payload, in bytes, that is compressed. Smaller payloads are
+					/// sent as they are, since compressing them gains little.
+					/// </summary>
+					unsigned long compression_threshold = 1024;
+
+					/// <summary>
+					/// The dictionaries the client has, in order of preference. If the server
+					/// has one of them too, it is used with Zstandard.
+					/// </summary>
+					std::vector<compression_dictionary> compression_dictionaries;
+
+					/// <summary>
+					/// How long, in microseconds, the client waits for more requests once one
+					/// is made, so that they're all written together. Leave at 0 to write
+					/// right away.
+					/// </summary>
+					///
+					/// <remarks>
+					/// Requests made while a write is in progress are always written together
+					/// next, however many threads make them, so this only helps when requests
+					/// come in bursts that are a little spread out, and it adds to the round
+					/// trip time of every request.
+					/// </remarks>
+					long cork_microseconds = 0;
 				};
 
 				client();
@@ -259,6 +462,27 @@ namespace liblec {
 					std::function<bool()> busy_function,
 					std::string& error);
 
+				/// <summary>
+				/// The outcome of a request made with <see cref="request"/> or
+				/// <see cref="send_data_async"/>.
+				/// </summary>
+				struct request_result {
+					/// <summary>
+					/// Whether the response was received.
+					/// </summary>
+					bool result = false;
+
+					/// <summary>
+					/// The data received from the server.
+					/// </summary>
+					std::string received;
+
+					/// <summary>
+					/// Error information, if the response wasn't received.
+					/// </summary>
+					std::string error;
+				};
+
 				/// <summary>
 				/// Send data to the server (asyncronously).
 				/// </summary>
@@ -281,20 +505,76 @@ namespace liblec {
 				/// </param>
 				///
 				/// <returns>
-				/// Returns true if the operation is successful, else false.
+				/// Returns true if the request was queued, else false, e.g. if the client isn't
+				/// connected, in which case there is no response to wait for.
 				/// </returns>
 				///
 				/// <remarks>
 				/// This is a non-blocking operation and the function returns almost immediately.
 				/// The actual sending will be executed asynchronously and the progress can be
-				/// known through <see cref="sending"/>. Note, however, that this process is
-				/// somewhat slower than using <see cref="send_data"/>.
+				/// known through <see cref="sending"/>, or through client_params::on_response and
+				/// client_params::on_error if either is set. No thread is started for the
+				/// request: it is written by the client thread, which matches the response to it
+				/// by message ID, so any number of requests can be in flight on the connection
+				/// at once.
 				/// </remarks>
 				bool send_data_async(const std::string& data,
 					const long& timeout_seconds,
 					unsigned long& data_id,
 					std::string& error);
 
+				/// <summary>
+				/// Send data to the server (asyncronously), with a future for the outcome.
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data to be sent.
+				/// </param>
+				///
+				/// <param name="timeout_seconds">
+				/// The timeout of the send/receive operation, in seconds.
+				/// </param>
+				///
+				/// <returns>
+				/// The outcome, once the response is received, the request times out or the
+				/// connection is lost.
+				/// </returns>
+				std::future<request_result> send_data_async(const std::string& data,
+					const long& timeout_seconds = 10);
+
+				/// <summary>
+				/// Send data to the server (asyncronously), with a function to call with the
+				/// outcome.
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data to be sent.
+				/// </param>
+				///
+				/// <param name="timeout_seconds">
+				/// The timeout of the send/receive operation, in seconds.
+				/// </param>
+				///
+				/// <param name="on_result">
+				/// Called once the response is received, the request times out or the connection
+				/// is lost, through client_params::executor if it's set. Otherwise it's called on
+				/// the client thread, and must not block, e.g. by calling
+				/// <see cref="send_data"/>, as no other response is received in the meantime.
+				/// </param>
+				///
+				/// <param name="error">
+				/// Error information.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if the request was made, else false, e.g. if the client isn't
+				/// connected, in which case on_result is never called.
+				/// </returns>
+				bool send_data_async(const std::string& data,
+					const long& timeout_seconds,
+					std::function<void(request_result result)> on_result,
+					std::string& error);
+
 				/// <summary>
 				/// Check if the data is still being sent.
 				/// </summary>
@@ -341,6 +621,178 @@ namespace liblec {
 					std::string& received,
 					std::string& error);
 
+				/// <summary>
+				/// The requests made with <see cref="send_batch"/>, whose outcomes can be waited
+				/// for all together or one at a time.
+				/// </summary>
+				///
+				/// <remarks>
+				/// The requests carry on if the batch is destroyed, but their outcomes are
+				/// discarded.
+				/// </remarks>
+				class lecnet_api batch {
+				public:
+					/// <summary>
+					/// An empty batch.
+					/// </summary>
+					batch();
+					batch(batch&& other) noexcept;
+					batch& operator=(batch&& other) noexcept;
+					~batch();
+
+					/// <summary>
+					/// Get the number of requests in the batch.
+					/// </summary>
+					size_t size() const;
+
+					/// <summary>
+					/// Check whether a request is done, i.e. its response was received, it
+					/// timed out or the connection was lost.
+					/// </summary>
+					///
+					/// <param name="index">
+					/// The index of the request's data in the data given to
+					/// <see cref="send_batch"/>.
+					/// </param>
+					bool done(size_t index) const;
+
+					/// <summary>
+					/// Wait for a request to be done.
+					/// </summary>
+					///
+					/// <param name="index">
+					/// The index of the request's data in the data given to
+					/// <see cref="send_batch"/>. Must be less than <see cref="size"/>.
+					/// </param>
+					///
+					/// <returns>
+					/// The outcome of the request, which remains valid as long as the batch.
+					/// </returns>
+					const request_result& get(size_t index);
+
+					/// <summary>
+					/// Wait for all the requests in the batch to be done.
+					/// </summary>
+					void wait();
+
+					/// <summary>
+					/// Wait for the next request to be done, in the order they are done in.
+					/// </summary>
+					///
+					/// <param name="index">
+					/// The index of the request, for <see cref="get"/>.
+					/// </param>
+					///
+					/// <returns>
+					/// Returns false once every request in the batch has been returned by this
+					/// function, else true.
+					/// </returns>
+					bool next(size_t& index);
+
+				private:
+					friend client;
+
+					class impl;
+					impl* _p_d = nullptr;
+
+					batch(const batch&) = delete;
+					batch& operator=(const batch&) = delete;
+				};
+
+				/// <summary>
+				/// Send a number of requests to the server at once.
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data of each request.
+				/// </param>
+				///
+				/// <param name="timeout_seconds">
+				/// The timeout of each request, in seconds.
+				/// </param>
+				///
+				/// <returns>
+				/// The batch of requests, in the order of the data. A request whose data is
+				/// empty, or that can't be made, e.g. because the client isn't connected, is
+				/// done right away with the reason in its error.
+				/// </returns>
+				///
+				/// <remarks>
+				/// The frames of all the requests are put together in one buffer on the calling
+				/// thread, and written to the socket in one go, rather than each taking a write
+				/// of its own.
+				/// </remarks>
+				batch send_batch(const std::vector<std::string>& data,
+					const long& timeout_seconds = 10);
+
+				/// <summary>
+				/// A request to the server for a C++20 coroutine to co_await, as made by
+				/// <see cref="request"/>.
+				/// </summary>
+				///
+				/// <remarks>
+				/// The data is sent when the request is awaited, and the coroutine is resumed
+				/// with a request_result once the response is received, the request times out
+				/// or the connection is lost, without a thread being held up in the meantime.
+				/// It is resumed on the client thread, so until it awaits something that
+				/// resumes it elsewhere it must not block, e.g. by calling
+				/// <see cref="send_data"/>.
+				/// </remarks>
+				class request_awaitable {
+				public:
+					request_awaitable(client& c,
+						const std::string& data,
+						long timeout_seconds) :
+						_p_client(&c),
+						_data(data),
+						_timeout_seconds(timeout_seconds) {}
+
+					bool await_ready() const { return false; }
+
+					/// <summary>
+					/// Send the request.
+					/// </summary>
+					///
+					/// <returns>
+					/// Returns false, for the coroutine to carry on right away, if the request
+					/// couldn't be sent.
+					/// </returns>
+					template <typename coroutine_handle>
+					bool await_suspend(coroutine_handle coroutine) {
+						return _p_client->start_request(*this,
+							[coroutine]() mutable { coroutine.resume(); });
+					}
+
+					request_result await_resume() { return std::move(_result); }
+
+				private:
+					friend client;
+
+					client* _p_client;
+					std::string _data;
+					long _timeout_seconds;
+					request_result _result;
+				};
+
+				/// <summary>
+				/// Make a request to the server for a C++20 coroutine to co_await, e.g.
+				/// auto result = co_await client.request(data);
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data to be sent.
+				/// </param>
+				///
+				/// <param name="timeout_seconds">
+				/// The timeout of the send/receive operation, in seconds.
+				/// </param>
+				///
+				/// <returns>
+				/// The request, which is only sent once it is awaited.
+				/// </returns>
+				request_awaitable request(const std::string& data,
+					const long& timeout_seconds = 10);
+
 				/// <summary>
 				/// Disconnect from server.
 				/// </summary>
@@ -362,6 +814,9 @@ namespace liblec {
 				class client_async;
 				class client_async_ssl;
 
+				bool start_request(request_awaitable& request,
+					std::function<void()> on_done);
+
 				client(const client&) = delete;
 				client& operator=(const client&) = delete;
 			};
@@ -426,52 +881,382 @@ namespace liblec {
 			// }
 			//
 
-			/// <summary>
-			/// Base class for TCP servers.
-			/// </summary>
-			class lecnet_api server {
-			public:
-				server() {}
-				virtual ~server() {}
+			/// <summary>
+			/// Base class for TCP servers.
+			/// </summary>
+			class lecnet_api server {
+			public:
+				server() {}
+				virtual ~server() {}
+
+				/// <summary>
+				/// Client network address.
+				/// </summary>
+				typedef std::string client_address;
+
+				/// <summary>
+				/// Client information.
+				/// </summary>
+				struct client_info {
+					/// <summary>
+					/// Client's network address.
+					/// </summary>
+					client_address address;
+
+					/// <summary>
+					/// Client's network traffic.
+					/// </summary>
+					liblec::lecnet::network_traffic traffic;
+				};
+
+				/// <summary>
+				/// A client's connection.
+				/// </summary>
+				struct connection {
+					/// <summary>
+					/// Client's network address.
+					/// </summary>
+					client_address address;
+
+					/// <summary>
+					/// An ID unique to this connection for as long as the server runs.
+					/// </summary>
+					unsigned long long id = 0;
+				};
+
+				/// <summary>
+				/// Writes the response to a client's data straight into the frame that is sent
+				/// back to the client.
+				/// </summary>
+				class lecnet_api response_writer {
+				public:
+					/// <summary>
+					/// Constructed by the server for each frame it receives.
+					/// </summary>
+					explicit response_writer(std::string& payload);
+
+					/// <summary>
+					/// Reserve space for a response of the given length, to avoid reallocation
+					/// when it is written a piece at a time.
+					/// </summary>
+					void reserve(size_t length);
+
+					/// <summary>
+					/// Append data to the response.
+					/// </summary>
+					void write(const char* data,
+						size_t length);
+
+					/// <summary>
+					/// Append data to the response.
+					/// </summary>
+					void write(std::string_view data);
+
+					/// <summary>
+					/// Get the length of the response written so far.
+					/// </summary>
+					size_t length() const;
+
+				private:
+					std::string& _payload;
+
+					response_writer(const response_writer&) = delete;
+					response_writer& operator=(const response_writer&) = delete;
+				};
+
+				/// <summary>
+				/// Sends the response to a client's data once it is ready, from any thread,
+				/// rather than when the function handling the data returns. See
+				/// <see cref="on_receive_async"/>.
+				/// </summary>
+				class lecnet_api pending_response {
+				public:
+					/// <summary>
+					/// Constructed by the server for each frame it receives.
+					/// </summary>
+					explicit pending_response(std::function<void(std::string payload)> on_send);
+					pending_response(pending_response&& other) noexcept;
+					pending_response& operator=(pending_response&& other) noexcept;
+
+					/// <summary>
+					/// If no response was sent, an empty one is, i.e. nothing is sent back, so
+					/// that the server isn't left waiting for it.
+					/// </summary>
+					~pending_response();
+
+					/// <summary>
+					/// Send the response. Only the first call sends anything.
+					/// </summary>
+					void send(std::string data);
+
+					/// <summary>
+					/// Check whether the response has yet to be sent.
+					/// </summary>
+					bool pending() const;
+
+				private:
+					class impl;
+					impl* _p_d = nullptr;
+
+					pending_response(const pending_response&) = delete;
+					pending_response& operator=(const pending_response&) = delete;
+				};
+
+				/// <summary>
+				/// Server parameters.
+				/// </summary>
+				struct server_params {
+					/// <summary>
+					/// Server IP address.
+					/// </summary>
+					std::string ip = "0.0.0.0";
+
+					/// <summary>
+					/// Server port.
+					/// </summary>
+					unsigned short port = 50001;
+
+					/// <summary>
+					/// The maximum number of clients that the server should accept.
+					/// </summary>
+					unsigned short max_clients = 1000;
+
+					/// <summary>
+					/// The maximum number of connections the server should accept per second.
+					/// Set to 0 for no limit.
+					/// </summary>
+					///
+					/// <remarks>
+					/// Connections beyond the limit, like those made while the server already
+					/// has <see cref="max_clients"/> clients, are left waiting in the operating
+					/// system's backlog until the server is ready for them, so that a storm of
+					/// reconnecting clients can't take up all of the I/O threads' time.
+					/// </remarks>
+					unsigned long max_accept_rate = 0;
+
+					/// <summary>
+					/// The number of connections that can be accepted in a burst, above
+					/// <see cref="max_accept_rate"/>, after a quiet spell. Set to 0 for one
+					/// second's worth.
+					/// </summary>
+					unsigned long accept_burst = 0;
+
+					/// <summary>
+					/// The path of a Unix domain socket through which the server can be handed
+					/// over to a successor process, e.g. for restarting it without dropping its
+					/// listening socket. Leave empty to not allow this.
+					/// </summary>
+					///
+					/// <remarks>
+					/// When the server starts it first tries to take over from a predecessor
+					/// listening on this path, in which case it uses the predecessor's
+					/// listening socket instead of binding its own. Either way it then listens
+					/// on the path for a successor of its own. When a successor takes over, the
+					/// server stops accepting connections, lets its clients' outstanding
+					/// requests complete as by <see cref="drain"/> and then stops, after which
+					/// <see cref="running"/> returns false. Not available on Windows.
+					///
+					/// Only the user the server runs as can connect to the socket, and only a
+					/// process running as that user is taken over from or handed over to. If
+					/// something other than a socket is at the path it's left alone, and the
+					/// server can't be handed over, which it notes in its log.
+					/// </remarks>
+					std::string handoff_path;
+
+					/// <summary>
+					/// Whether to hand idle connections over to a successor as well, so that
+					/// their clients don't need to reconnect. A connection is idle if it has
+					/// nothing being received, handled or sent.
+					/// </summary>
+					///
+					/// <remarks>
+					/// Only plain connections can be handed over; SSL connections are always
+					/// drained, as their session state can't leave the process, and so are
+					/// connections that agreed on a compression codec.
+					/// </remarks>
+					bool handoff_clients = false;
+
+					/// <summary>
+					/// The number of threads that run the server's I/O. Set to 0 to use one
+					/// thread per processor core.
+					/// </summary>
+					///
+					/// <remarks>
+					/// Data from any one client is always handled in the order it is received,
+					/// but with more than one thread <see cref="on_receive"/> can be called
+					/// concurrently for different clients.
+					/// </remarks>
+					unsigned short io_threads = 1;
+
+					/// <summary>
+					/// Whether to give each I/O thread its own io_service and acceptor (a shard)
+					/// instead of having all the I/O threads share one.
+					/// </summary>
+					///
+					/// <remarks>
+					/// A client stays on the shard that accepted it. Where the platform supports
+					/// SO_REUSEPORT every shard listens on the port and the operating system
+					/// spreads incoming connections across them; elsewhere a single acceptor
+					/// deals connections out to the shards in turn.
+					/// </remarks>
+					bool sharded = false;
+
+					/// <summary>
+					/// The number of worker threads to call <see cref="on_receive"/> on. Set to 0
+					/// to call it directly on the I/O threads.
+					/// </summary>
+					///
+					/// <remarks>
+					/// With worker threads a slow on_receive only holds up the clients whose
+					/// data it is handling instead of every client on the same I/O thread. Data
+					/// from any one client is handled by the same worker, in order, unless
+					/// <see cref="max_frames_in_flight"/> is more than 1.
+					/// </remarks>
+					unsigned short worker_threads = 0;
+
+					/// <summary>
+					/// The most frames a worker's queue holds. A client whose frames don't fit
+					/// is not read from until there is room for them. Only used if
+					/// <see cref="worker_threads"/> is not 0.
+					/// </summary>
+					unsigned long worker_queue_capacity = 1024;
+
+					/// <summary>
+					/// The maximum number of frames from one client that can be handled at the
+					/// same time.
+					/// </summary>
+					///
+					/// <remarks>
+					/// With more than 1 the server keeps reading a client's frames while earlier
+					/// ones are still being handled, and each response is sent as soon as it is
+					/// ready. Responses can then arrive out of order, and are matched to their
+					/// requests by message ID (as done by <see cref="client"/>). Frames are only
+					/// ever handled concurrently if <see cref="worker_threads"/> is not 0 or
+					/// <see cref="asynchronous_handlers"/> is set.
+					/// </remarks>
+					unsigned long max_frames_in_flight = 1;
+
+					/// <summary>
+					/// Whether to hand data to on_receive_async() rather than on_receive(), so
+					/// that a response can be sent once it's ready instead of when the handler
+					/// returns, without holding up a thread in the meantime.
+					/// </summary>
+					///
+					/// <remarks>
+					/// A frame counts towards <see cref="max_frames_in_flight"/> until its
+					/// response is sent, so raise it for a client to have more than one frame
+					/// handled at a time.
+					/// </remarks>
+					bool asynchronous_handlers = false;
+
+					/// <summary>
+					/// The number of response bytes that can be waiting to be sent to one client
+					/// before the server stops reading from that client. Set to 0 for no limit.
+					/// </summary>
+					///
+					/// <remarks>
+					/// A client that doesn't read its responses fast enough is made to wait
+					/// instead of having them pile up in the server's memory. Reading resumes
+					/// once the waiting responses drop below half this limit.
+					/// </remarks>
+					unsigned long max_write_queue_bytes = 4 * 1024 * 1024;
+
+					/// <summary>
+					/// The largest frame a client can send, header included. Set to 0 for no
+					/// limit.
+					/// </summary>
+					///
+					/// <remarks>
+					/// A client that announces a larger frame is disconnected as soon as the
+					/// frame's header arrives, before any memory is allocated for it. With no
+					/// limit, frames are still limited to just under 1 GiB where an unsigned
+					/// long is 32 bits, e.g. on Windows.
+					/// </remarks>
+					unsigned long max_frame_size = 64 * 1024 * 1024;
 
-				/// <summary>
-				/// Client network address.
-				/// </summary>
-				typedef std::string client_address;
+					/// <summary>
+					/// The number of bytes one client's frames and responses can take up in the
+					/// server's memory. Set to 0 for no limit.
+					/// </summary>
+					///
+					/// <remarks>
+					/// This covers frames being received, frames being handled and responses
+					/// waiting to be sent. When it is used up the server stops reading from the
+					/// client, rather than allocate more memory, until some is released. A frame
+					/// larger than this is still received if the client has nothing else in
+					/// memory, so it should be no less than <see cref="max_frame_size"/>.
+					/// </remarks>
+					unsigned long max_client_memory = 0;
 
-				/// <summary>
-				/// Client information.
-				/// </summary>
-				struct client_info {
 					/// <summary>
-					/// Client's network address.
+					/// The number of bytes all the clients' frames and responses together can
+					/// take up in the server's memory. Set to 0 for no limit.
 					/// </summary>
-					client_address address;
+					///
+					/// <remarks>
+					/// As with <see cref="max_client_memory"/>, when it is used up the server
+					/// stops reading from the clients that need more until some is released.
+					/// </remarks>
+					unsigned long long max_server_memory = 0;
 
 					/// <summary>
-					/// Client's network traffic.
+					/// The number of seconds a client can stay connected without sending
+					/// anything while it has no responses pending. Set to 0 for no limit.
 					/// </summary>
-					liblec::lecnet::network_traffic traffic;
-				};
+					unsigned long idle_timeout_seconds = 0;
 
-				/// <summary>
-				/// Server parameters.
-				/// </summary>
-				struct server_params {
 					/// <summary>
-					/// Server IP address.
+					/// The number of seconds a client has to send the rest of a frame header
+					/// once it has started sending one. Set to 0 for no limit.
 					/// </summary>
-					std::string ip = "0.0.0.0";
+					///
+					/// <remarks>
+					/// This stops a client from holding a connection open by trickling a frame
+					/// header in a byte at a time.
+					/// </remarks>
+					unsigned long read_header_timeout_seconds = 0;
 
 					/// <summary>
-					/// Server port.
+					/// The number of seconds the server waits for a batch of responses to be
+					/// sent before giving up on the client. Set to 0 for no limit.
 					/// </summary>
-					unsigned short port = 50001;
+					///
+					/// <remarks>
+					/// The timeouts are checked by one timer wheel per I/O thread (see
+					/// <see cref="io_threads"/>) rather than a timer per client, to a resolution
+					/// of about a quarter of a second.
+					/// </remarks>
+					unsigned long write_timeout_seconds = 0;
 
 					/// <summary>
-					/// The maximum number of clients that the server should accept.
+					/// The codecs the server can compress data with, for the clients that ask
+					/// for one of them through client_params::compression_codecs. Leave empty
+					/// for no compression.
 					/// </summary>
-					unsigned short max_clients = 1000;
+					///
+					/// <remarks>
+					/// With worker threads, payloads are compressed and decompressed on the
+					/// workers rather than on the I/O threads. A compressed payload that would
+					/// be larger than <see cref="max_frame_size"/> once decompressed is treated
+					/// as an oversize frame.
+					/// </remarks>
+					std::vector<compression> compression_codecs;
+
+					/// <summary>
+					/// The smallest payload, in bytes, that is compressed. Smaller payloads are
+					/// sent as they are, since compressing them gains little.
+					/// </summary>
+					unsigned long compression_threshold = 1024;
+
+					/// <summary>
+					/// The dictionaries the server has, for the clients that use Zstandard and
+					/// have one of them in client_params::compression_dictionaries.
+					/// </summary>
+					///
+					/// <remarks>
+					/// Data that is broadcast is compressed once with each of them.
+					/// </remarks>
+					std::vector<compression_dictionary> compression_dictionaries;
 
 					/// <summary>
 					/// The server certificate.
@@ -566,6 +1351,73 @@ namespace liblec {
 				/// </remarks>
 				virtual bool stop() = 0;
 
+				/// <summary>
+				/// Stop server gracefully.
+				/// </summary>
+				///
+				/// <param name="timeout_seconds">
+				/// How long to give the clients' outstanding requests to be handled.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if all the clients were drained before the timeout, else false.
+				/// </returns>
+				///
+				/// <remarks>
+				/// New connections are refused and no more data is read from the connected
+				/// clients. Each client's connection is closed as soon as the data already
+				/// received from it has been handled and the responses sent. Whatever
+				/// connections are left when the timeout elapses are closed regardless, and the
+				/// server is then stopped as by <see cref="stop"/>.
+				/// </remarks>
+				virtual bool drain(const long& timeout_seconds) = 0;
+
+				/// <summary>
+				/// Send data to a client without the client asking for it.
+				/// </summary>
+				///
+				/// <param name="address">
+				/// The address of the client.
+				/// </param>
+				///
+				/// <param name="data">
+				/// The data to send.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if the data was queued for sending, else false, e.g. if there is
+				/// no client with the given address, or the data is too large for a frame (see
+				/// <see cref="tcp::client"/>).
+				/// </returns>
+				///
+				/// <remarks>
+				/// The client receives the data through client_params::on_push. It is sent after
+				/// whatever is already waiting to be sent to the client. A client whose data
+				/// waiting to be sent has reached server_params::max_write_queue_bytes is not
+				/// keeping up, and is disconnected rather than left to miss data. Can be called
+				/// from any thread, including from within <see cref="on_receive"/>.
+				/// </remarks>
+				virtual bool send(const client_address& address,
+					const std::string& data) = 0;
+
+				/// <summary>
+				/// Send data to all the connected clients without them asking for it.
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data to send.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns the number of clients the data was queued for.
+				/// </returns>
+				///
+				/// <remarks>
+				/// The data is framed once and the same copy of it is queued to every client,
+				/// however many there are. Otherwise as <see cref="send"/>.
+				/// </remarks>
+				virtual size_t broadcast(const std::string& data) = 0;
+
 				/// <summary>
 				/// Get information of currently connected clients.
 				/// </summary>
@@ -584,6 +1436,16 @@ namespace liblec {
 				/// </param>
 				virtual void traffic(liblec::lecnet::network_traffic& traffic) = 0;
 
+				/// <summary>
+				/// Get the number of frames waiting in each worker thread's queue.
+				/// </summary>
+				///
+				/// <param name="depths">
+				/// The number of frames waiting, one entry per worker thread. Empty if the
+				/// server does not use worker threads.
+				/// </param>
+				virtual void get_worker_queue_depths(std::vector<size_t>& depths) = 0;
+
 				/// <summary>
 				/// Called whenever an event is logged.
 				/// </summary>
@@ -620,11 +1482,67 @@ namespace liblec {
 				/// </returns>
 				///
 				/// <remarks>
-				/// The sooner this function returns the faster the asynchronous server.
+				/// The sooner this function returns the faster the asynchronous server. When the
+				/// server runs more than one I/O thread this function can be called concurrently
+				/// for different clients, so it must be thread safe.
 				/// </remarks>
 				virtual std::string on_receive(const client_address& address,
 					const std::string& data_received) = 0;
 
+				/// <summary>
+				/// Called whenever data is received, without copying it.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// A view of the data received from the client. It is only valid until this
+				/// function returns.
+				/// </param>
+				///
+				/// <param name="response">
+				/// Where to write the data to send back to the client, if any.
+				/// </param>
+				///
+				/// <remarks>
+				/// Override this instead of the overload that takes a std::string to handle data
+				/// where it was received rather than in a copy of it, and to write the response
+				/// into the frame that is sent. By default it calls the other overload.
+				/// </remarks>
+				virtual void on_receive(const connection& conn,
+					std::string_view data_received,
+					response_writer& response) = 0;
+
+				/// <summary>
+				/// Called whenever data is received, instead of on_receive(), if
+				/// server_params::asynchronous_handlers is set.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// The data received from the client.
+				/// </param>
+				///
+				/// <param name="response">
+				/// For sending the data to send back to the client, if any, now or later and
+				/// from any thread.
+				/// </param>
+				///
+				/// <remarks>
+				/// Must not block: start whatever the response is waiting on and return, e.g.
+				/// by starting a coroutine (see tcp_coroutine.h). Responses sent after the
+				/// server stops are discarded. By default it calls on_receive() and sends the
+				/// response right away.
+				/// </remarks>
+				virtual void on_receive_async(const connection& conn,
+					std::string data_received,
+					pending_response response) = 0;
+
 			private:
 				server(const server&) = delete;
 				server& operator=(const server&) = delete;
@@ -635,8 +1553,9 @@ namespace liblec {
 			/// </summary>
 			///
 			/// <remarks>
-			/// Based on boost asio. Uses a single thread (event driven). This class does not use
-			/// any encryption. As such, use it with care. Avoid using it on an unsecure network.
+			/// Based on boost asio. Uses a pool of I/O threads (event driven), the size of which
+			/// is set through server_params::io_threads. This class does not use any encryption.
+			/// As such, use it with care. Avoid using it on an unsecure network.
 			/// </remarks>
 			class lecnet_api server_async : public server {
 			public:
@@ -714,6 +1633,73 @@ namespace liblec {
 				/// </remarks>
 				bool stop();
 
+				/// <summary>
+				/// Stop server gracefully.
+				/// </summary>
+				///
+				/// <param name="timeout_seconds">
+				/// How long to give the clients' outstanding requests to be handled.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if all the clients were drained before the timeout, else false.
+				/// </returns>
+				///
+				/// <remarks>
+				/// New connections are refused and no more data is read from the connected
+				/// clients. Each client's connection is closed as soon as the data already
+				/// received from it has been handled and the responses sent. Whatever
+				/// connections are left when the timeout elapses are closed regardless, and the
+				/// server is then stopped as by <see cref="stop"/>.
+				/// </remarks>
+				bool drain(const long& timeout_seconds);
+
+				/// <summary>
+				/// Send data to a client without the client asking for it.
+				/// </summary>
+				///
+				/// <param name="address">
+				/// The address of the client.
+				/// </param>
+				///
+				/// <param name="data">
+				/// The data to send.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if the data was queued for sending, else false, e.g. if there is
+				/// no client with the given address, or the data is too large for a frame (see
+				/// <see cref="tcp::client"/>).
+				/// </returns>
+				///
+				/// <remarks>
+				/// The client receives the data through client_params::on_push. It is sent after
+				/// whatever is already waiting to be sent to the client. A client whose data
+				/// waiting to be sent has reached server_params::max_write_queue_bytes is not
+				/// keeping up, and is disconnected rather than left to miss data. Can be called
+				/// from any thread, including from within <see cref="on_receive"/>.
+				/// </remarks>
+				bool send(const client_address& address,
+					const std::string& data);
+
+				/// <summary>
+				/// Send data to all the connected clients without them asking for it.
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data to send.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns the number of clients the data was queued for.
+				/// </returns>
+				///
+				/// <remarks>
+				/// The data is framed once and the same copy of it is queued to every client,
+				/// however many there are. Otherwise as <see cref="send"/>.
+				/// </remarks>
+				size_t broadcast(const std::string& data);
+
 				/// <summary>
 				/// Get information of currently connected clients.
 				/// </summary>
@@ -732,6 +1718,16 @@ namespace liblec {
 				/// </param>
 				void traffic(liblec::lecnet::network_traffic& traffic);
 
+				/// <summary>
+				/// Get the number of frames waiting in each worker thread's queue.
+				/// </summary>
+				///
+				/// <param name="depths">
+				/// The number of frames waiting, one entry per worker thread. Empty if the
+				/// server does not use worker threads.
+				/// </param>
+				void get_worker_queue_depths(std::vector<size_t>& depths);
+
 				/// <summary>
 				/// Called whenever an event is logged.
 				/// </summary>
@@ -768,11 +1764,66 @@ namespace liblec {
 				/// </returns>
 				///
 				/// <remarks>
-				/// The sooner this function returns the faster the asynchronous server.
+				/// The sooner this function returns the faster the asynchronous server. When the
+				/// server runs more than one I/O thread this function can be called concurrently
+				/// for different clients, so it must be thread safe.
 				/// </remarks>
 				virtual std::string on_receive(const client_address& address,
 					const std::string& data_received) { return std::string(); };
 
+				/// <summary>
+				/// Called whenever data is received, without copying it.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// A view of the data received from the client. It is only valid until this
+				/// function returns.
+				/// </param>
+				///
+				/// <param name="response">
+				/// Where to write the data to send back to the client, if any.
+				/// </param>
+				///
+				/// <remarks>
+				/// Override this instead of the overload that takes a std::string to handle data
+				/// where it was received rather than in a copy of it, and to write the response
+				/// into the frame that is sent. By default it calls the other overload.
+				/// </remarks>
+				virtual void on_receive(const connection& conn,
+					std::string_view data_received,
+					response_writer& response);
+
+				/// <summary>
+				/// Called whenever data is received, instead of on_receive(), if
+				/// server_params::asynchronous_handlers is set.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// The data received from the client.
+				/// </param>
+				///
+				/// <param name="response">
+				/// For sending the data to send back to the client, if any, now or later and
+				/// from any thread.
+				/// </param>
+				///
+				/// <remarks>
+				/// Must not block: start whatever the response is waiting on and return, e.g.
+				/// by starting a coroutine (see tcp_coroutine.h). By default it calls
+				/// on_receive() and sends the response right away.
+				/// </remarks>
+				virtual void on_receive_async(const connection& conn,
+					std::string data_received,
+					pending_response response);
+
 			private:
 				class impl;
 				impl& _d;
@@ -789,7 +1840,8 @@ namespace liblec {
 			/// </summary>
 			///
 			/// <remarks>
-			/// Based on boost asio. Uses a single thread (event driven).
+			/// Based on boost asio. Uses a pool of I/O threads (event driven), the size of which
+			/// is set through server_params::io_threads.
 			/// </remarks>
 			class lecnet_api server_async_ssl : public server {
 			public:
@@ -867,6 +1919,73 @@ namespace liblec {
 				/// </remarks>
 				bool stop();
 
+				/// <summary>
+				/// Stop server gracefully.
+				/// </summary>
+				///
+				/// <param name="timeout_seconds">
+				/// How long to give the clients' outstanding requests to be handled.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if all the clients were drained before the timeout, else false.
+				/// </returns>
+				///
+				/// <remarks>
+				/// New connections are refused and no more data is read from the connected
+				/// clients. Each client's connection is closed as soon as the data already
+				/// received from it has been handled and the responses sent. Whatever
+				/// connections are left when the timeout elapses are closed regardless, and the
+				/// server is then stopped as by <see cref="stop"/>.
+				/// </remarks>
+				bool drain(const long& timeout_seconds);
+
+				/// <summary>
+				/// Send data to a client without the client asking for it.
+				/// </summary>
+				///
+				/// <param name="address">
+				/// The address of the client.
+				/// </param>
+				///
+				/// <param name="data">
+				/// The data to send.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns true if the data was queued for sending, else false, e.g. if there is
+				/// no client with the given address, or the data is too large for a frame (see
+				/// <see cref="tcp::client"/>).
+				/// </returns>
+				///
+				/// <remarks>
+				/// The client receives the data through client_params::on_push. It is sent after
+				/// whatever is already waiting to be sent to the client. A client whose data
+				/// waiting to be sent has reached server_params::max_write_queue_bytes is not
+				/// keeping up, and is disconnected rather than left to miss data. Can be called
+				/// from any thread, including from within <see cref="on_receive"/>.
+				/// </remarks>
+				bool send(const client_address& address,
+					const std::string& data);
+
+				/// <summary>
+				/// Send data to all the connected clients without them asking for it.
+				/// </summary>
+				///
+				/// <param name="data">
+				/// The data to send.
+				/// </param>
+				///
+				/// <returns>
+				/// Returns the number of clients the data was queued for.
+				/// </returns>
+				///
+				/// <remarks>
+				/// The data is framed once and the same copy of it is queued to every client,
+				/// however many there are. Otherwise as <see cref="send"/>.
+				/// </remarks>
+				size_t broadcast(const std::string& data);
+
 				/// <summary>
 				/// Get information of currently connected clients.
 				/// </summary>
@@ -885,6 +2004,16 @@ namespace liblec {
 				/// </param>
 				void traffic(liblec::lecnet::network_traffic& traffic);
 
+				/// <summary>
+				/// Get the number of frames waiting in each worker thread's queue.
+				/// </summary>
+				///
+				/// <param name="depths">
+				/// The number of frames waiting, one entry per worker thread. Empty if the
+				/// server does not use worker threads.
+				/// </param>
+				void get_worker_queue_depths(std::vector<size_t>& depths);
+
 				/// <summary>
 				/// Called whenever an event is logged.
 				/// </summary>
@@ -921,11 +2050,66 @@ namespace liblec {
 				/// </returns>
 				///
 				/// <remarks>
-				/// The sooner this function returns the faster the asynchronous server.
+				/// The sooner this function returns the faster the asynchronous server. When the
+				/// server runs more than one I/O thread this function can be called concurrently
+				/// for different clients, so it must be thread safe.
 				/// </remarks>
 				virtual std::string on_receive(const client_address& address,
 					const std::string& data_received) { return std::string(); };
 
+				/// <summary>
+				/// Called whenever data is received, without copying it.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// A view of the data received from the client. It is only valid until this
+				/// function returns.
+				/// </param>
+				///
+				/// <param name="response">
+				/// Where to write the data to send back to the client, if any.
+				/// </param>
+				///
+				/// <remarks>
+				/// Override this instead of the overload that takes a std::string to handle data
+				/// where it was received rather than in a copy of it, and to write the response
+				/// into the frame that is sent. By default it calls the other overload.
+				/// </remarks>
+				virtual void on_receive(const connection& conn,
+					std::string_view data_received,
+					response_writer& response);
+
+				/// <summary>
+				/// Called whenever data is received, instead of on_receive(), if
+				/// server_params::asynchronous_handlers is set.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// The data received from the client.
+				/// </param>
+				///
+				/// <param name="response">
+				/// For sending the data to send back to the client, if any, now or later and
+				/// from any thread.
+				/// </param>
+				///
+				/// <remarks>
+				/// Must not block: start whatever the response is waiting on and return, e.g.
+				/// by starting a coroutine (see tcp_coroutine.h). By default it calls
+				/// on_receive() and sends the response right away.
+				/// </remarks>
+				virtual void on_receive_async(const connection& conn,
+					std::string data_received,
+					pending_response response);
+
 			private:
 				class impl;
 				impl& _d;
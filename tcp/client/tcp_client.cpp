@@ -15,8 +15,20 @@
 #include "../../tcp.h"
 #include "../../auto_mutex/auto_mutex.h"
 #include "../../helper_fxns/helper_fxns.h"
+#include "../frame/frame_decoder.h"
+#include "../frame/frame_header.h"
+#include "../frame/buffer_pool.h"
+#include "../frame/frame_compression.h"
+#include "../frame/write_queue.h"
 
 #include <future>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
 
 #define _CRT_SECURE_NO_WARNINGS
 #define ASIO_STANDALONE
@@ -54,6 +66,14 @@ typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> ssl_socket;	// se
 /// </remarks>
 typedef boost::asio::ip::tcp::resolver::iterator tcp_iterator;
 
+/// <summary>
+/// The read buffers shared by all the clients in the process.
+/// </summary>
+static buffer_pool& client_buffers() {
+	static buffer_pool pool;
+	return pool;
+}
+
 /// <summary>
 /// Structure for connet results.
 /// </summary>
@@ -73,15 +93,67 @@ struct received_data {
 	bool received = false;
 	std::string data = "";
 	std::string error;
+
+	// the codec the data is still compressed with, if any, and the dictionary
+	frame_compression::codec codec = frame_compression::codec::none;
+	const frame_compression::dictionary* p_dictionary = nullptr;
+
+	// called when the request is done, on the client thread unless the request failed on the
+	// thread that made it, along with the timer that times it out if the client thread does
+	std::function<void(received_data& request)> on_done;
+	std::shared_ptr<boost::asio::deadline_timer> p_timer;
 };
 
-struct send_info {
-	unsigned long data_id;
-	std::string data;
+/// <summary>
+/// Where a thread blocked in send_data() waits for the client thread to finish its request.
+/// </summary>
+struct completion_slot {
+	std::mutex lock;
+	std::condition_variable finished_condition;
+	bool finished = false;
+	received_data result;
+};
+
+// how often send_data() calls its busy function while waiting
+const std::chrono::milliseconds busy_function_interval(10);
+
+/// <summary>
+/// A request's frame on its way to the client thread, which writes it.
+/// </summary>
+struct submitted_request {
+	unsigned long message_id;
 	long timeout_seconds;
-	std::future<void> fut;
+	outgoing_frame frame;
+};
+
+/// <summary>
+/// The outcomes of a batch of requests, shared by the batch and the requests in it.
+/// </summary>
+struct batch_state {
+	std::mutex lock;
+	std::condition_variable done_condition;
+	std::vector<liblec::lecnet::tcp::client::request_result> results;
+	std::vector<bool> done;
+
+	// the indices of the requests in the order they were done, and how many of them
+	// batch::next() has returned
+	std::vector<size_t> done_order;
+	size_t next = 0;
+
+	void finish(size_t index,
+		liblec::lecnet::tcp::client::request_result&& result) {
+		std::lock_guard<std::mutex> state_lock(lock);
+		results[index] = std::move(result);
+		done[index] = true;
+		done_order.push_back(index);
+		done_condition.notify_all();
+	}
+};
 
-	bool result;
+struct send_info {
+	bool done = false;
+
+	bool result = false;
 	std::string received;
 	std::string error;
 };
@@ -93,11 +165,51 @@ public:
 
 	static void client_func(liblec::lecnet::tcp::client* p_current);
 
-	void do_send_data(const std::string& raw_to_send,
-		unsigned long id);
-
-	static void send_func(unsigned long data_id,
-		client* p_current);
+	bool compress_payload(std::string_view payload,
+		std::string& compressed);
+	outgoing_frame make_frame(std::string payload,
+		unsigned long id,
+		unsigned long flags = 0);
+	void append_frame(std::string_view payload,
+		unsigned long id,
+		std::string& frames);
+	void queue_frame(outgoing_frame&& frame);
+	void write();
+	void write_done(const boost::system::error_code& error,
+		size_t bytes_transferred);
+
+	void offer_codecs();
+	void control_received(std::string_view payload);
+	void push_received(std::string data,
+		bool compressed);
+
+	void dispatch(std::function<void()> handler);
+	void connection_changed(bool connected,
+		const std::string& error);
+	void request_handled(unsigned long data_id,
+		request_result& result);
+
+	unsigned long add_request(std::function<void(received_data& request)> on_done);
+	bool send_request(unsigned long message_id,
+		outgoing_frame&& frame,
+		long timeout_seconds);
+	bool send_requests(const std::vector<unsigned long>& message_ids,
+		outgoing_frame&& frames,
+		long timeout_seconds);
+	void write_submitted();
+	static request_result outcome(received_data& received);
+	bool make_request(std::string data,
+		long timeout_seconds,
+		std::function<void(request_result& result)> on_result,
+		std::string& error);
+	void frame_received(frame_decoder::frame& f);
+	void arm_timer(unsigned long message_id,
+		long timeout_seconds);
+	void fail_request(unsigned long message_id,
+		const std::string& error,
+		const boost::asio::deadline_timer* p_timer = nullptr);
+	void finish_request(received_data& request);
+	void end_requests(const std::string& error);
 
 	std::future<void> _fut;
 	boost::asio::io_service* _p_io_service = nullptr;
@@ -108,9 +220,23 @@ public:
 	unsigned short _port;
 	bool _use_ssl;
 	std::string _ca_cert_path;
+	std::function<void(const std::string& data)> _on_push;
+	std::function<void(bool connected, const std::string& error)> _on_connected;
+	std::function<void(unsigned long data_id, const std::string& received)> _on_response;
+	std::function<void(unsigned long data_id, const std::string& error)> _on_error;
+	std::function<void(std::function<void()> handler)> _executor;
+	std::vector<liblec::lecnet::tcp::compression> _compression_codecs;
+	size_t _compression_threshold = 0;
+
+	frame_compression::dictionaries _compression_dictionaries;
+
+	// the codec agreed on with the server, and the dictionary if any, set on the client
+	// thread; the dictionary is set first, as it's read after the codec
+	std::atomic<frame_compression::codec> _codec{ frame_compression::codec::none };
+	std::atomic<const frame_compression::dictionary*> _p_dictionary{ nullptr };
 
 	// in-class message ID tracker to ensure each message is sent with a unique ID
-	unsigned long _message_id = 0;
+	std::atomic<unsigned long> _message_id{ 0 };
 	unsigned long _data_id = 0;
 
 	std::string _error;
@@ -119,13 +245,36 @@ public:
 	connect_result _result;
 	liblec::mutex _result_lock;
 
-	// Map for data received from the server. Key is the message ID and value is the data.
-	std::map<unsigned long, received_data> _data;
+	// The requests waiting on the server. Key is the message ID and value is the request.
+	std::unordered_map<unsigned long, received_data> _data;
 	liblec::mutex _data_lock;
 
+	// whether asynchronous requests can be made, i.e. the client is connected and the client
+	// thread is there to finish them; guarded by _data_lock
+	bool _requests_open = false;
+
+	// the requests made since the client thread last took them, guarded by _data_lock; the
+	// client thread is only woken up for the first of them, and takes them all at once
+	std::vector<submitted_request> _submitted;
+
+	// the requests the client thread is writing, only ever touched on it
+	std::vector<submitted_request> _submitted_taken;
+
+	// how long the client thread waits for more requests before writing the first of them, and
+	// whether it's waiting
+	long _cork_microseconds = 0;
+	bool _corked = false;
+
 	std::map<unsigned long, send_info> _send_queue;
 	liblec::mutex _send_queue_lock;
 
+	// the frames waiting to be written; only the client thread writes to the socket, so these
+	// are only ever touched on it
+	write_queue _write_queue;
+	std::vector<write_queue::segment> _segments;
+	std::vector<boost::asio::const_buffer> _buffers;
+	bool _writing = false;
+
 	liblec::lecnet::network_traffic _traffic;
 	liblec::mutex _traffic_lock;
 
@@ -192,6 +341,12 @@ public:
 
 	void handle_connect(const boost::system::error_code& error) {
 		if (!error) {
+			// frames are already put together before they're written, so waiting for more
+			// data to fill a segment only holds up the last one
+			boost::system::error_code option_error;
+			_socket.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true),
+				option_error);
+
 			long time_out = _p_this_client->_d._timeout_seconds;
 
 			if (time_out > 0) {
@@ -225,6 +380,15 @@ public:
 
 			_p_this_client->_d._p_socket = &_socket;
 
+			// before anything else is sent, so that the codec is agreed on first
+			_p_this_client->_d.offer_codecs();
+
+			// it's essential to limit the scope of this mutex
+			{
+				liblec::auto_mutex lock(_p_this_client->_d._data_lock);
+				_p_this_client->_d._requests_open = true;
+			}
+
 			// it's essential to limit the scope of this mutex
 			{
 				liblec::auto_mutex lock(_p_this_client->_d._result_lock);
@@ -238,6 +402,8 @@ public:
 				_p_this_client->_d._connecting = false;
 			}
 
+			_p_this_client->_d.connection_changed(true, std::string());
+
 			execute();
 		}
 		else {
@@ -253,94 +419,82 @@ public:
 
 	// execute entry point
 	void execute() {
-		// read data
-		while (true) {
-			boost::system::error_code error;
-			size_t bytes_transferred = _socket.read_some(boost::asio::buffer(_buffer, buffer_size),
-				error);
-
-			{
-				liblec::auto_mutex lock(_p_this_client->_d._traffic_lock);
-				_p_this_client->_d._traffic.in += bytes_transferred;
-			}
+		_decoder.reset(_p_this_client->_d._magic_number);
+		do_read();
+	}
 
-			if (!error) {
-				_received += std::string(_buffer, bytes_transferred);
-
-				// retrieve magic number
-				if (get_ul_prefix(_received, 1) == _p_this_client->_d._magic_number) {
-					// retrieve embedded length
-					unsigned long length = get_ul_prefix(_received, 3);
-
-					if (length == _received.length()) {
-						// all data has been received
-
-						// retrieve message ID
-						unsigned long message_id = get_ul_prefix(_received, 2);
-
-						// process the data
-						process_received_data(_received, message_id);
-
-						// clear
-						_received.clear();
-					}
-					else {
-						if (length > _received.length()) {
-							// essential to stay connected
-						}
-						else {
-							// invalid data received
-							liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-							_p_this_client->_d._error = "Invalid data received";
-							break;
-						}
-					}
-				}
-				else {
-					// invalid data received
-					liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-					_p_this_client->_d._error = "Invalid data received";
-					break;
-				}
-			}
-			else {
-				// client disconnected
-				liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-				_p_this_client->_d._error = "Client disconnected from server: " + error.message();
-				break;
-			}
+private:
+	void do_read() {
+		// read large payloads straight into place rather than through a read buffer
+		char* p_payload = nullptr;
+		size_t payload_size = 0;
+		_direct = _decoder.payload_buffer(p_payload, payload_size) &&
+			payload_size >= buffer_pool::max_size;
+
+		if (!_direct) {
+			// the stream may already hold decrypted data that a wait on the socket wouldn't
+			// see, so read straight away; while no frame is arriving a small buffer will do,
+			// as the stream keeps whatever doesn't fit for the next read
+			_buffer = client_buffers().get(_decoder.partial() ?
+				buffer_pool::max_size : buffer_pool::min_size);
 		}
 
-		_stopped = true;
-		_deadline.cancel();
+		_socket.async_read_some(_direct ?
+			boost::asio::buffer(p_payload, payload_size) :
+			boost::asio::buffer(_buffer.data(), _buffer.size()),
+			boost::bind(&client_async_ssl::handle_read, this,
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred));
 	}
 
-private:
-	void process_received_data(std::string& data,
-		unsigned long message_id) {
-		// skip magic number
-		get_ul_prefix(data);
+	void handle_read(const boost::system::error_code& error,
+		size_t bytes_transferred) {
+		{
+			liblec::auto_mutex lock(_p_this_client->_d._traffic_lock);
+			_p_this_client->_d._traffic.in += bytes_transferred;
+		}
 
-		// skip message id
-		get_ul_prefix(data);
+		if (error) {
+			// client disconnected
+			stop("Client disconnected from server: " + error.message());
+			return;
+		}
+
+		auto on_frame = [this](frame_decoder::frame& f) {
+			_p_this_client->_d.frame_received(f);
+		};
 
-		// skip embedded length
-		get_ul_prefix(data);
+		if (_direct)
+			_decoder.commit(bytes_transferred, on_frame);
+		else {
+			std::string feed_error;
+			const bool fed = _decoder.feed(_buffer.data(), bytes_transferred, on_frame,
+				feed_error);
 
-		liblec::auto_mutex lock(_p_this_client->_d._data_lock);
+			_buffer.release();
 
-		try {
-			if (_p_this_client->_d._data.find(message_id) !=
-				_p_this_client->_d._data.end()) {
-				_p_this_client->_d._data.at(message_id).data = data;
-				_p_this_client->_d._data.at(message_id).received = true;
+			if (!fed) {
+				// invalid data received
+				stop(feed_error);
+				return;
 			}
 		}
-		catch (std::exception& e) {
-			// probably already deleted from map
+
+		do_read();
+	}
+
+	void stop(const std::string& error) {
+		// it's essential to limit the scope of this mutex
+		{
 			liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-			_p_this_client->_d._error = "Exception: " + std::string(e.what());
+			_p_this_client->_d._error = error;
 		}
+
+		_stopped = true;
+		_deadline.cancel();
+
+		// the requests still waiting won't be getting a response
+		_p_this_client->_d.end_requests(error);
 	}
 
 	void check_deadline() {
@@ -374,15 +528,16 @@ private:
 		return _socket.lowest_layer();
 	}
 
-	enum { buffer_size = 1024 * 64 };
-	char _buffer[buffer_size];
-
 	liblec::lecnet::tcp::client* _p_this_client = nullptr;
 
 	boost::asio::deadline_timer _deadline;
-	std::string _received;
+	frame_decoder _decoder;
 	ssl_socket _socket;
 	bool _stopped;
+
+	// the read buffer of the read in progress, unless the payload is read straight into place
+	buffer_pool::buffer _buffer;
+	bool _direct = false;
 };
 
 class liblec::lecnet::tcp::client::client_async {
@@ -432,8 +587,22 @@ public:
 			// infinity so that the actor takes no action until a new deadline is set.
 			_deadline.expires_at(boost::posix_time::pos_infin);
 
+			// frames are already put together before they're written, so waiting for more
+			// data to fill a segment only holds up the last one
+			boost::system::error_code option_error;
+			_socket.set_option(boost::asio::ip::tcp::no_delay(true), option_error);
+
 			_p_this_client->_d._p_socket = &_socket;
 
+			// before anything else is sent, so that the codec is agreed on first
+			_p_this_client->_d.offer_codecs();
+
+			// it's essential to limit the scope of this mutex
+			{
+				liblec::auto_mutex lock(_p_this_client->_d._data_lock);
+				_p_this_client->_d._requests_open = true;
+			}
+
 			// it's essential to limit the scope of this mutex
 			{
 				liblec::auto_mutex lock(_p_this_client->_d._result_lock);
@@ -447,6 +616,8 @@ public:
 				_p_this_client->_d._connecting = false;
 			}
 
+			_p_this_client->_d.connection_changed(true, std::string());
+
 			execute();
 		}
 		else {
@@ -462,83 +633,93 @@ public:
 
 	// execute entry point
 	void execute() {
-		// read data
-		while (true) {
-			boost::system::error_code error;
-			size_t bytes_transferred = _socket.read_some(boost::asio::buffer(_buffer, buffer_size),
-				error);
+		_decoder.reset(_p_this_client->_d._magic_number);
+		do_read();
+	}
 
-			{
-				liblec::auto_mutex lock(_p_this_client->_d._traffic_lock);
-				_p_this_client->_d._traffic.in += bytes_transferred;
-			}
+private:
+	void do_read() {
+		// read large payloads straight into place rather than through a read buffer
+		char* p_payload = nullptr;
+		size_t payload_size = 0;
+		_direct = _decoder.payload_buffer(p_payload, payload_size) &&
+			payload_size >= buffer_pool::max_size;
+
+		if (_direct) {
+			_socket.async_read_some(boost::asio::buffer(p_payload, payload_size),
+				boost::bind(&client_async::handle_read, this,
+					boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred));
+			return;
+		}
 
-			if (!error) {
-				_received += std::string(_buffer, bytes_transferred);
-
-				// retrieve magic number
-				if (get_ul_prefix(_received, 1) == _p_this_client->_d._magic_number) {
-					// retrieve embedded length
-					unsigned long length = get_ul_prefix(_received, 3);
-
-					if (length == _received.length()) {
-						// all data has been received
-
-						// retrieve message ID
-						unsigned long message_id = get_ul_prefix(_received, 2);
-
-						// process the data
-						process_received_data(_received, message_id);
-
-						// clear
-						_received.clear();
-					}
-					else {
-						if (length > _received.length()) {
-							// essential to stay connected
-						}
-						else {
-							// invalid data received
-							liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-							_p_this_client->_d._error = "Invalid data received";
-							break;
-						}
-					}
-				}
-				else {
-					// invalid data received
-					liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-					_p_this_client->_d._error = "Invalid data received";
-					break;
-				}
+		// wait for data to arrive before taking a read buffer big enough for it
+		_socket.async_wait(plain_socket::wait_read,
+			[this](const boost::system::error_code& error) {
+			if (error) {
+				handle_read(error, 0);
+				return;
 			}
-			else {
-				// client disconnected
-				liblec::auto_mutex lock(_p_this_client->_d._error_lock);
-				_p_this_client->_d._error = "Client disconnected from server: " + error.message();
-				break;
+
+			boost::system::error_code read_error;
+			const size_t available = _socket.available(read_error);
+			_buffer = client_buffers().get(std::max(available, size_t(1)));
+
+			const size_t bytes_transferred = _socket.read_some(
+				boost::asio::buffer(_buffer.data(), _buffer.size()), read_error);
+
+			handle_read(read_error, bytes_transferred);
+		});
+	}
+
+	void handle_read(const boost::system::error_code& error,
+		size_t bytes_transferred) {
+		{
+			liblec::auto_mutex lock(_p_this_client->_d._traffic_lock);
+			_p_this_client->_d._traffic.in += bytes_transferred;
+		}
+
+		if (error) {
+			// client disconnected
+			stop("Client disconnected from server: " + error.message());
+			return;
+		}
+
+		auto on_frame = [this](frame_decoder::frame& f) {
+			_p_this_client->_d.frame_received(f);
+		};
+
+		if (_direct)
+			_decoder.commit(bytes_transferred, on_frame);
+		else {
+			std::string feed_error;
+			const bool fed = _decoder.feed(_buffer.data(), bytes_transferred, on_frame,
+				feed_error);
+
+			_buffer.release();
+
+			if (!fed) {
+				// invalid data received
+				stop(feed_error);
+				return;
 			}
 		}
 
-		_stopped = true;
-		_deadline.cancel();
+		do_read();
 	}
 
-private:
-	void process_received_data(std::string& data,
-		unsigned long message_id) {
-		// skip magic number
-		get_ul_prefix(data);
-
-		// skip message id
-		get_ul_prefix(data);
+	void stop(const std::string& error) {
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(_p_this_client->_d._error_lock);
+			_p_this_client->_d._error = error;
+		}
 
-		// skip embedded length
-		get_ul_prefix(data);
+		_stopped = true;
+		_deadline.cancel();
 
-		liblec::auto_mutex lock(_p_this_client->_d._data_lock);
-		_p_this_client->_d._data[message_id].data = data;
-		_p_this_client->_d._data[message_id].received = true;
+		// the requests still waiting won't be getting a response
+		_p_this_client->_d.end_requests(error);
 	}
 
 	void check_deadline() {
@@ -568,15 +749,16 @@ private:
 		_deadline.async_wait(boost::bind(&client_async::check_deadline, this));
 	}
 
-	enum { buffer_size = 1024 * 64 };
-	char _buffer[buffer_size];
-
 	liblec::lecnet::tcp::client* _p_this_client = nullptr;
 
 	boost::asio::deadline_timer _deadline;
-	std::string _received;
+	frame_decoder _decoder;
 	plain_socket _socket;
 	bool _stopped;
+
+	// the read buffer of the read in progress, unless the payload is read straight into place
+	buffer_pool::buffer _buffer;
+	bool _direct = false;
 };
 
 liblec::lecnet::tcp::client::client() :
@@ -636,6 +818,14 @@ void liblec::lecnet::tcp::client::impl::client_func(
 			p_current->_d._error = "Exception: " + std::string(e.what());
 		}
 
+		// in case the client thread is exiting without the connection having been lost
+		p_current->_d.end_requests("Not connected to server");
+
+		// whatever was still to be written goes with the connection
+		p_current->_d._write_queue.clear();
+		p_current->_d._writing = false;
+		p_current->_d._corked = false;
+
 		// client thread exiting
 	}
 	catch (std::exception& e) {
@@ -670,6 +860,8 @@ void liblec::lecnet::tcp::client::impl::client_func(
 		delete p_current->_d._p_io_service;
 		p_current->_d._p_io_service = nullptr;
 	}
+
+	p_current->_d.connection_changed(false, cached_error);
 }
 
 bool liblec::lecnet::tcp::client::connect(const client_params& params,
@@ -685,6 +877,16 @@ bool liblec::lecnet::tcp::client::connect(const client_params& params,
 	_d._use_ssl = params.use_ssl;
 	_d._ca_cert_path = params.ca_cert_path;
 	_d._magic_number = params.magic_number;
+	_d._on_push = params.on_push;
+	_d._on_connected = params.on_connected;
+	_d._on_response = params.on_response;
+	_d._on_error = params.on_error;
+	_d._executor = params.executor;
+	_d._cork_microseconds = params.cork_microseconds;
+	_d._compression_codecs = params.compression_codecs;
+	_d._compression_threshold = params.compression_threshold;
+	_d._compression_dictionaries =
+		frame_compression::prepare(params.compression_dictionaries);
 
 	try {
 		// it's essential to limit the scope of this mutex
@@ -734,44 +936,458 @@ bool liblec::lecnet::tcp::client::running() {
 		return false;
 }
 
-void liblec::lecnet::tcp::client::impl::do_send_data(const std::string& raw_to_send,
-	unsigned long id) {
-	std::string to_send;
+bool liblec::lecnet::tcp::client::impl::compress_payload(std::string_view payload,
+	std::string& compressed) {
+	// compress the data here, on the sending thread, once a codec has been agreed on
+	const auto codec = _codec.load();
+	const frame_compression::dictionary* p_dictionary = _p_dictionary;
+
+	return codec != frame_compression::codec::none &&
+		payload.length() >= _compression_threshold &&
+		frame_compression::compress(codec, p_dictionary, payload, compressed);
+}
+
+outgoing_frame liblec::lecnet::tcp::client::impl::make_frame(std::string payload,
+	unsigned long id,
+	unsigned long flags) {
+	if (flags == 0) {
+		std::string compressed;
+
+		if (compress_payload(payload, compressed)) {
+			payload.swap(compressed);
+			flags |= frame_decoder::compressed_flag;
+		}
+	}
+
+	outgoing_frame frame;
+	frame.header = frame_header(_magic_number, id, payload.length(), flags);
+	frame.payload = std::move(payload);
+	return frame;
+}
+
+void liblec::lecnet::tcp::client::impl::append_frame(std::string_view payload,
+	unsigned long id,
+	std::string& frames) {
+	std::string compressed;
+	unsigned long flags = 0;
+
+	if (compress_payload(payload, compressed)) {
+		payload = compressed;
+		flags |= frame_decoder::compressed_flag;
+	}
+
+	const frame_header header(_magic_number, id, payload.length(), flags);
+	frames.append(header.data, frame_header::size);
+	frames.append(payload);
+}
+
+void liblec::lecnet::tcp::client::impl::queue_frame(outgoing_frame&& frame) {
+	// there's nothing to send without data
+	if (frame.payload.empty())
+		return;
+
+	_write_queue.push(std::move(frame));
+	write();
+}
 
-	if (!raw_to_send.empty()) {
-		to_send = raw_to_send;
+void liblec::lecnet::tcp::client::impl::write() {
+	// one batch at a time, with whatever was queued in the meantime going in the next one
+	if (_writing || _write_queue.empty() || !_p_socket)
+		return;
 
-		unsigned long length = static_cast<unsigned long>
-			(to_send.length() * sizeof(char))	// space for the actual message
-			+ sizeof(unsigned long)				// space for data length
-			+ sizeof(unsigned long)				// space for message ID
-			+ sizeof(unsigned long);			// space magic number
+	_write_queue.prepare(_segments);
+	_buffers.clear();
 
-		// prefix data with it's length
-		prefix_with_ul(length, to_send);
+	for (auto const& it : _segments)
+		_buffers.push_back(boost::asio::buffer(it.data, it.size));
 
-		// prefix with message ID
-		prefix_with_ul(id, to_send);
+	_writing = true;
 
-		// prefix with magic number
-		prefix_with_ul(_magic_number, to_send);
+	auto handler = boost::bind(&impl::write_done, this,
+		boost::asio::placeholders::error,
+		boost::asio::placeholders::bytes_transferred);
 
-		// send data to server
+	if (_use_ssl)
+		boost::asio::async_write(*((ssl_socket*)_p_socket), _buffers, handler);
+	else
+		boost::asio::async_write(*((plain_socket*)_p_socket), _buffers, handler);
+}
+
+void liblec::lecnet::tcp::client::impl::write_done(const boost::system::error_code& error,
+	size_t bytes_transferred) {
+	_writing = false;
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_traffic_lock);
+		_traffic.out += bytes_transferred;
+	}
+
+	if (error) {
+		_write_queue.clear();
+
+		// so that the reader finds out too, and ends the requests
 		if (_p_socket) {
-			size_t bytes_transferred = 0;
+			boost::system::error_code shutdown_error;
 
-			if (_use_ssl) {
-				bytes_transferred = boost::asio::write(*((ssl_socket*)_p_socket),
-					boost::asio::buffer(to_send.c_str(), to_send.length()));
-			}
-			else {
-				bytes_transferred = boost::asio::write(*((plain_socket*)_p_socket),
-					boost::asio::buffer(to_send.c_str(), to_send.length()));
-			}
+			if (_use_ssl)
+				((ssl_socket*)_p_socket)->lowest_layer().shutdown(plain_socket::shutdown_both,
+					shutdown_error);
+			else
+				((plain_socket*)_p_socket)->shutdown(plain_socket::shutdown_both,
+					shutdown_error);
+		}
+
+		return;
+	}
+
+	_write_queue.consume();
+	write();
+}
+
+void liblec::lecnet::tcp::client::impl::offer_codecs() {
+	_codec = frame_compression::codec::none;
+	_p_dictionary = nullptr;
+
+	if (_compression_codecs.empty())
+		return;
+
+	// the server answers with a control frame of its own
+	const std::string offer = frame_compression::offer(_compression_codecs,
+		_compression_dictionaries);
+
+	// not if none of the codecs were built in
+	if (offer.length() > 2)
+		queue_frame(make_frame(offer, 0, frame_decoder::control_flag));
+}
+
+void liblec::lecnet::tcp::client::impl::control_received(std::string_view payload) {
+	frame_compression::dictionary_ptr p_dictionary;
+	const auto codec = frame_compression::chosen(payload, _compression_dictionaries,
+		p_dictionary);
+
+	_p_dictionary = p_dictionary.get();
+	_codec = codec;
+}
+
+void liblec::lecnet::tcp::client::impl::push_received(std::string data,
+	bool compressed) {
+	// message 0 is never sent by a client, so it's data the server sent on its own
+	if (!_on_push)
+		return;
+
+	if (compressed) {
+		std::string decompressed;
+		std::string error;
+
+		if (!frame_compression::decompress(_codec, _p_dictionary, data, decompressed,
+			error)) {
+			liblec::auto_mutex lock(_error_lock);
+			_error = error;
+			return;
+		}
+
+		data.swap(decompressed);
+	}
+
+	dispatch([on_push = _on_push, data = std::move(data)]() { on_push(data); });
+}
+
+void liblec::lecnet::tcp::client::impl::dispatch(std::function<void()> handler) {
+	try {
+		// the handler only holds copies of what it needs, so it doesn't matter when it's run
+		if (_executor)
+			_executor(std::move(handler));
+		else
+			handler();
+	}
+	catch (std::exception& e) {
+		liblec::auto_mutex lock(_error_lock);
+		_error = "Exception: " + std::string(e.what());
+	}
+}
+
+void liblec::lecnet::tcp::client::impl::connection_changed(bool connected,
+	const std::string& error) {
+	if (!_on_connected)
+		return;
 
-			liblec::auto_mutex lock(_traffic_lock);
-			_traffic.out += bytes_transferred;
+	dispatch([on_connected = _on_connected, connected, error]() {
+		on_connected(connected, error);
+	});
+}
+
+void liblec::lecnet::tcp::client::impl::request_handled(unsigned long data_id,
+	request_result& result) {
+	dispatch([on_response = _on_response, on_error = _on_error, data_id,
+		result = std::move(result)]() {
+		if (result.result) {
+			if (on_response)
+				on_response(data_id, result.received);
 		}
+		else if (on_error)
+			on_error(data_id, result.error);
+	});
+}
+
+liblec::lecnet::tcp::client::request_result
+liblec::lecnet::tcp::client::impl::outcome(received_data& received) {
+	request_result result;
+
+	if (!received.received)
+		result.error = received.error;
+	else if (received.codec != frame_compression::codec::none)
+		result.result = frame_compression::decompress(received.codec, received.p_dictionary,
+			received.data, result.received, result.error);
+	else {
+		result.received = std::move(received.data);
+		result.result = true;
+	}
+
+	return result;
+}
+
+unsigned long liblec::lecnet::tcp::client::impl::add_request(
+	std::function<void(received_data& request)> on_done) {
+	// the ID is picked without the lock; 0 is skipped when it wraps around, as it's for
+	// pushes and control frames
+	unsigned long message_id = ++_message_id;
+
+	if (message_id == 0)
+		message_id = ++_message_id;
+
+	liblec::auto_mutex lock(_data_lock);
+
+	if (!_requests_open || !_p_socket)
+		return 0;
+
+	_data[message_id].on_done = std::move(on_done);
+	return message_id;
+}
+
+bool liblec::lecnet::tcp::client::impl::send_request(unsigned long message_id,
+	outgoing_frame&& frame,
+	long timeout_seconds) {
+	liblec::auto_mutex lock(_data_lock);
+
+	// the request was ended with the connection
+	if (!_requests_open)
+		return false;
+
+	// the frame is written, and the request timed out, on the client thread, which is running
+	// while requests are open; it's only woken up if it hasn't been already, so a burst of
+	// requests from any number of threads is written together
+	_submitted.push_back({ message_id, timeout_seconds, std::move(frame) });
+
+	if (_submitted.size() == 1)
+		_p_io_service->post([this]() { write_submitted(); });
+
+	return true;
+}
+
+bool liblec::lecnet::tcp::client::impl::send_requests(
+	const std::vector<unsigned long>& message_ids,
+	outgoing_frame&& frames,
+	long timeout_seconds) {
+	liblec::auto_mutex lock(_data_lock);
+
+	// the requests were ended with the connection
+	if (!_requests_open || message_ids.empty())
+		return false;
+
+	// every request gets its timer, and the frames go with the first of them
+	const size_t first = _submitted.size();
+
+	for (auto const& it : message_ids)
+		_submitted.push_back({ it, timeout_seconds, outgoing_frame() });
+
+	_submitted[first].frame = std::move(frames);
+
+	if (first == 0)
+		_p_io_service->post([this]() { write_submitted(); });
+
+	return true;
+}
+
+void liblec::lecnet::tcp::client::impl::write_submitted() {
+	// give more requests the chance to join these ones
+	if (_cork_microseconds > 0 && !_corked) {
+		_corked = true;
+
+		auto p_timer = std::make_shared<boost::asio::deadline_timer>(*_p_io_service,
+			boost::posix_time::microseconds(_cork_microseconds));
+
+		p_timer->async_wait([this, p_timer](const boost::system::error_code& error) {
+			if (!error)
+				write_submitted();
+		});
+
+		return;
+	}
+
+	_corked = false;
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_data_lock);
+		_submitted_taken.swap(_submitted);
+
+		// all the timers are armed under the one lock
+		for (auto const& it : _submitted_taken)
+			if (it.timeout_seconds > 0)
+				arm_timer(it.message_id, it.timeout_seconds);
+	}
+
+	for (auto& it : _submitted_taken)
+		if (it.frame.p_shared || !it.frame.payload.empty())
+			_write_queue.push(std::move(it.frame));
+
+	_submitted_taken.clear();
+	write();
+}
+
+bool liblec::lecnet::tcp::client::impl::make_request(std::string data,
+	long timeout_seconds,
+	std::function<void(request_result& result)> on_result,
+	std::string& error) {
+	if (!frame_header::fits(data.length())) {
+		error = "Data too large to send";
+		return false;
+	}
+
+	const unsigned long message_id = add_request([on_result](received_data& received) {
+		request_result result = outcome(received);
+		on_result(result);
+	});
+
+	if (message_id == 0) {
+		error = "Not connected to server";
+		return false;
+	}
+
+	try {
+		send_request(message_id, make_frame(std::move(data), message_id),
+			timeout_seconds > 0 ? timeout_seconds : 10);	// default to 10 seconds
+	}
+	catch (std::exception& e) {
+		fail_request(message_id, "Exception: " + std::string(e.what()));
+	}
+
+	return true;
+}
+
+void liblec::lecnet::tcp::client::impl::frame_received(frame_decoder::frame& f) {
+	if (f.control) {
+		control_received(f.payload);
+		return;
+	}
+
+	if (f.message_id == 0) {
+		push_received(f.take(), f.compressed);
+		return;
+	}
+
+	received_data request;
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_data_lock);
+		auto it = _data.find(f.message_id);
+
+		// e.g. the request timed out
+		if (it == _data.end())
+			return;
+
+		request = std::move(it->second);
+		_data.erase(it);
+	}
+
+	request.data = f.take();
+	request.codec = f.compressed ? _codec.load() : frame_compression::codec::none;
+	request.p_dictionary = _p_dictionary;
+	request.received = true;
+
+	finish_request(request);
+}
+
+void liblec::lecnet::tcp::client::impl::arm_timer(unsigned long message_id,
+	long timeout_seconds) {
+	// _data_lock is held by the caller
+	auto it = _data.find(message_id);
+
+	// the request is already done
+	if (it == _data.end())
+		return;
+
+	auto p_timer = std::make_shared<boost::asio::deadline_timer>(*_p_io_service,
+		boost::posix_time::seconds(timeout_seconds));
+
+	p_timer->async_wait([this, message_id, p = p_timer.get()](
+		const boost::system::error_code& error) {
+		if (!error)
+			fail_request(message_id, "Send/Receive timeout", p);
+	});
+
+	it->second.p_timer = p_timer;
+}
+
+void liblec::lecnet::tcp::client::impl::fail_request(unsigned long message_id,
+	const std::string& error,
+	const boost::asio::deadline_timer* p_timer) {
+	received_data request;
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_data_lock);
+		auto it = _data.find(message_id);
+
+		// the request is already done, and the ID may have been reused since
+		if (it == _data.end() || (p_timer && it->second.p_timer.get() != p_timer))
+			return;
+
+		request = std::move(it->second);
+		_data.erase(it);
+	}
+
+	request.error = error;
+	finish_request(request);
+}
+
+void liblec::lecnet::tcp::client::impl::finish_request(received_data& request) {
+	if (request.p_timer) {
+		boost::system::error_code error;
+		request.p_timer->cancel(error);
+	}
+
+	try {
+		request.on_done(request);
+	}
+	catch (std::exception& e) {
+		liblec::auto_mutex lock(_error_lock);
+		_error = "Exception: " + std::string(e.what());
+	}
+}
+
+void liblec::lecnet::tcp::client::impl::end_requests(const std::string& error) {
+	std::vector<received_data> requests;
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_data_lock);
+		_requests_open = false;
+
+		// the client thread won't be there to write them
+		_submitted.clear();
+
+		for (auto& it : _data)
+			requests.push_back(std::move(it.second));
+
+		_data.clear();
+	}
+
+	for (auto& it : requests) {
+		it.error = error;
+		finish_request(it);
 	}
 }
 
@@ -780,91 +1396,85 @@ bool liblec::lecnet::tcp::client::send_data(const std::string& data,
 	const long& timeout_seconds,
 	std::function<bool()> busy_function,
 	std::string& error) {
-	unsigned long message_id = 0;
-	boost::asio::deadline_timer* p_deadline = nullptr;
+	received.clear();
 
 	if (!running()) {
 		error = "Not connected to server";
 		return false;
 	}
 
-	try {
-		if (_d._p_io_service)
-			p_deadline = new boost::asio::deadline_timer(*_d._p_io_service);
+	if (!frame_header::fits(data.length())) {
+		error = "Data too large to send";
+		return false;
+	}
 
-		// Set a deadline for the send/receive operation.
-		long time_out = 10;	// default to 10 seconds
+	// the client thread finishes the request and wakes this thread up, which waits without
+	// using any CPU in the meantime
+	auto p_slot = std::make_shared<completion_slot>();
 
-		if (timeout_seconds > 0)
-			time_out = timeout_seconds;
+	const unsigned long message_id = _d.add_request([p_slot](received_data& request) {
+		std::lock_guard<std::mutex> lock(p_slot->lock);
+		p_slot->result = std::move(request);
+		p_slot->finished = true;
+		p_slot->finished_condition.notify_one();
+	});
 
-		if (p_deadline)
-			p_deadline->expires_from_now(boost::posix_time::seconds(time_out));
+	if (message_id == 0) {
+		error = "Not connected to server";
+		return false;
+	}
 
-		received.clear();
+	try {
+		// the response is waited for here, with no timer on the client thread
+		_d.send_request(message_id, _d.make_frame(data, message_id), 0);
+	}
+	catch (std::exception& e) {
+		_d.fail_request(message_id, "Exception: " + std::string(e.what()));
+	}
 
-		if (_d._p_socket) {
-			if (_d._message_id < max_prefix_size())
-				_d._message_id++;
-			else
-				_d._message_id = 1;
+	// Set a deadline for the send/receive operation.
+	long time_out = 10;	// default to 10 seconds
 
-			message_id = _d._message_id;
+	if (timeout_seconds > 0)
+		time_out = timeout_seconds;
 
-			{
-				auto_mutex lock(_d._data_lock);
-				received_data data;
-				_d._data.insert(
-					std::pair<unsigned long, received_data>(message_id, data));
-			}
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(time_out);
+	auto finished = [&p_slot]() { return p_slot->finished; };
 
-			_d.do_send_data(data, message_id);
-
-			// wait until data has been sent, and response is received from server
-			while (running()) {
-				{
-					auto_mutex lock(_d._data_lock);
-					if (_d._data[message_id].received)
-						break;
-				}
-
-				if (busy_function)
-					busy_function();
-
-				if (p_deadline) {
-					if (p_deadline->expires_at() <=
-						boost::asio::deadline_timer::traits_type::now()) {
-						// timeout_seconds has passed
-						auto_mutex lock(_d._data_lock);
-						_d._data[message_id].error = "Send/Receive timeout";
-						p_deadline->cancel();
-						break;
-					}
-				}
-			}
-		}
-	}
-	catch (std::exception& e) {
-		auto_mutex lock(_d._data_lock);
-		_d._data[message_id].error = "Exception: " + std::string(e.what());
-	}
+	// wait until data has been sent, and response is received from server
+	std::unique_lock<std::mutex> slot_lock(p_slot->lock);
 
-	if (p_deadline) {
-		try {
-			p_deadline->cancel();
-			delete p_deadline;
-			p_deadline = nullptr;
+	while (!p_slot->finished) {
+		const auto now = std::chrono::steady_clock::now();
+
+		if (now >= deadline) {
+			// timeout_seconds has passed
+			slot_lock.unlock();
+			_d.fail_request(message_id, "Send/Receive timeout");
+			slot_lock.lock();
+
+			// unless the client thread got to the request first, and is finishing it
+			p_slot->finished_condition.wait(slot_lock, finished);
+			break;
 		}
-		catch (std::exception& e) {
-			auto_mutex lock(_d._data_lock);
-			_d._data[message_id].error = "Exception: " + std::string(e.what());
+
+		if (busy_function) {
+			slot_lock.unlock();
+			busy_function();
+			slot_lock.lock();
+
+			p_slot->finished_condition.wait_until(slot_lock,
+				std::min(deadline, now + busy_function_interval), finished);
 		}
+		else
+			p_slot->finished_condition.wait_until(slot_lock, deadline, finished);
 	}
 
-	auto_mutex lock(_d._data_lock);
+	received_data result = std::move(p_slot->result);
+	slot_lock.unlock();
 
-	if (_d._data[message_id].data.empty()) {
-		if (_d._data[message_id].error.empty()) {
+	if (result.data.empty()) {
+		if (result.error.empty()) {
 			auto_mutex lock(_d._error_lock);
 			if (!_d._error.empty()) {
 				error = _d._error;
@@ -873,91 +1483,126 @@ bool liblec::lecnet::tcp::client::send_data(const std::string& data,
 			else
 				error = "Not connected to server";	// what else could have happened?
 		}
-		else {
-			error = _d._data[message_id].error;
-			_d._data[message_id].error.clear();
-		}
+		else
+			error = result.error;
 
-		_d._data.erase(message_id);
 		return false;
 	}
 
-	received = _d._data[message_id].data;
-	_d._data.erase(message_id);
+	// decompressed on this thread rather than on the client thread, which has other data to
+	// receive
+	if (result.codec != frame_compression::codec::none)
+		return frame_compression::decompress(result.codec, result.p_dictionary, result.data,
+			received, error);
 
+	received = std::move(result.data);
 	return true;
 }
 
-void liblec::lecnet::tcp::client::impl::send_func(unsigned long data_id,
-	client* p_current) {
-	try {
-		bool result = true;
-		std::string received;
-		std::string error;
-
-		// send data (blocking call)
-		result = p_current->send_data(p_current->_d._send_queue.at(data_id).data, received,
-			p_current->_d._send_queue.at(data_id).timeout_seconds, nullptr, error);
-
-		liblec::auto_mutex lock(p_current->_d._send_queue_lock);
+liblec::lecnet::tcp::client::request_awaitable
+liblec::lecnet::tcp::client::request(const std::string& data,
+	const long& timeout_seconds) {
+	return request_awaitable(*this, data, timeout_seconds);
+}
 
-		p_current->_d._send_queue.at(data_id).result = result;
-		p_current->_d._send_queue.at(data_id).received = received;
-		p_current->_d._send_queue.at(data_id).error = error;
-	}
-	catch (std::exception& e) {
-		liblec::auto_mutex lock(p_current->_d._send_queue_lock);
+bool liblec::lecnet::tcp::client::start_request(request_awaitable& request,
+	std::function<void()> on_done) {
+	// the request can be done, and the awaitable gone, as soon as it's made
+	request_result* p_result = &request._result;
 
-		p_current->_d._send_queue.at(data_id).result = false;
-		p_current->_d._send_queue.at(data_id).received.clear();
-		p_current->_d._send_queue.at(data_id).error = e.what();
-	}
+	return _d.make_request(std::move(request._data), request._timeout_seconds,
+		[p_result, on_done](request_result& result) {
+		*p_result = std::move(result);
+		on_done();
+	}, p_result->error);
 }
 
 bool liblec::lecnet::tcp::client::send_data_async(const std::string& data,
 	const long& timeout_seconds,
 	unsigned long& data_id,
 	std::string& error) {
-	if (_d._data_id < max_prefix_size())
-		_d._data_id++;
-	else
-		_d._data_id = 1;
+	// with handlers the outcome goes to them, instead of being kept for get_response()
+	const bool handlers = _d._on_response || _d._on_error;
 
-	data_id = _d._data_id;
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_d._send_queue_lock);
 
-	liblec::auto_mutex lock(_d._send_queue_lock);
+		if (_d._data_id < max_prefix_size())
+			_d._data_id++;
+		else
+			_d._data_id = 1;
 
-	_d._send_queue[data_id].data_id = data_id;
-	_d._send_queue[data_id].data = data;
-	_d._send_queue[data_id].timeout_seconds = timeout_seconds;
+		data_id = _d._data_id;
 
-	try {
-		// run send task asynchronously
-		_d._send_queue[data_id].fut = std::async(std::launch::async,
-			_d.send_func, data_id, this);
+		if (!handlers)
+			_d._send_queue[data_id] = send_info();
 	}
-	catch (std::exception& e) {
-		error = e.what();
+
+	auto on_result = [this, data_id, handlers](request_result& result) {
+		if (handlers) {
+			_d.request_handled(data_id, result);
+			return;
+		}
+
+		liblec::auto_mutex lock(_d._send_queue_lock);
+		auto it = _d._send_queue.find(data_id);
+
+		// unless the response was asked for before it was received
+		if (it == _d._send_queue.end())
+			return;
+
+		it->second.result = result.result;
+		it->second.received = std::move(result.received);
+		it->second.error = std::move(result.error);
+		it->second.done = true;
+	};
+
+	if (!_d.make_request(data, timeout_seconds, on_result, error)) {
+		// there is no response to wait for
+		liblec::auto_mutex lock(_d._send_queue_lock);
+		_d._send_queue.erase(data_id);
 		return false;
 	}
 
 	return true;
 }
 
+std::future<liblec::lecnet::tcp::client::request_result>
+liblec::lecnet::tcp::client::send_data_async(const std::string& data,
+	const long& timeout_seconds) {
+	auto p_promise = std::make_shared<std::promise<request_result>>();
+	auto outcome = p_promise->get_future();
+	std::string error;
+
+	if (!_d.make_request(data, timeout_seconds, [p_promise](request_result& result) {
+		p_promise->set_value(std::move(result));
+	}, error)) {
+		request_result result;
+		result.error = error;
+		p_promise->set_value(std::move(result));
+	}
+
+	return outcome;
+}
+
+bool liblec::lecnet::tcp::client::send_data_async(const std::string& data,
+	const long& timeout_seconds,
+	std::function<void(request_result result)> on_result,
+	std::string& error) {
+	return _d.make_request(data, timeout_seconds, [this, on_result](request_result& result) {
+		_d.dispatch([on_result, result = std::move(result)]() mutable {
+			on_result(std::move(result));
+		});
+	}, error);
+}
+
 bool liblec::lecnet::tcp::client::sending(const unsigned long& data_id) {
 	liblec::auto_mutex lock(_d._send_queue_lock);
+	auto it = _d._send_queue.find(data_id);
 
-	try {
-		if (_d._send_queue.at(data_id).fut.valid())
-			return _d._send_queue.at(data_id).fut.wait_for(std::chrono::seconds{ 0 }) !=
-			std::future_status::ready;
-		else
-			return false;
-	}
-	catch (std::exception&) {
-		// probably already deleted from map
-		return false;
-	}
+	// unless it's already been deleted from the map
+	return it != _d._send_queue.end() && !it->second.done;
 }
 
 bool liblec::lecnet::tcp::client::get_response(const unsigned long& data_id,
@@ -984,6 +1629,161 @@ bool liblec::lecnet::tcp::client::get_response(const unsigned long& data_id,
 	}
 }
 
+class liblec::lecnet::tcp::client::batch::impl {
+public:
+	std::shared_ptr<batch_state> p_state = std::make_shared<batch_state>();
+};
+
+liblec::lecnet::tcp::client::batch::batch() :
+	_p_d(new impl) {}
+
+liblec::lecnet::tcp::client::batch::batch(batch&& other) noexcept :
+	_p_d(other._p_d) {
+	other._p_d = nullptr;
+}
+
+liblec::lecnet::tcp::client::batch&
+liblec::lecnet::tcp::client::batch::operator=(batch&& other) noexcept {
+	if (this != &other) {
+		delete _p_d;
+		_p_d = other._p_d;
+		other._p_d = nullptr;
+	}
+
+	return *this;
+}
+
+liblec::lecnet::tcp::client::batch::~batch() {
+	delete _p_d;
+}
+
+size_t liblec::lecnet::tcp::client::batch::size() const {
+	// fixed once the batch is sent
+	return _p_d ? _p_d->p_state->results.size() : 0;
+}
+
+bool liblec::lecnet::tcp::client::batch::done(size_t index) const {
+	if (index >= size())
+		return false;
+
+	std::lock_guard<std::mutex> lock(_p_d->p_state->lock);
+	return _p_d->p_state->done[index];
+}
+
+const liblec::lecnet::tcp::client::request_result&
+liblec::lecnet::tcp::client::batch::get(size_t index) {
+	if (index >= size())
+		throw std::out_of_range("Invalid batch index");
+
+	auto& state = *_p_d->p_state;
+	std::unique_lock<std::mutex> lock(state.lock);
+	state.done_condition.wait(lock, [&state, index]() { return state.done[index]; });
+
+	// never written to again once it's done
+	return state.results[index];
+}
+
+void liblec::lecnet::tcp::client::batch::wait() {
+	if (size() == 0)
+		return;
+
+	auto& state = *_p_d->p_state;
+	std::unique_lock<std::mutex> lock(state.lock);
+	state.done_condition.wait(lock, [&state]() {
+		return state.done_order.size() == state.results.size();
+	});
+}
+
+bool liblec::lecnet::tcp::client::batch::next(size_t& index) {
+	if (size() == 0)
+		return false;
+
+	auto& state = *_p_d->p_state;
+	std::unique_lock<std::mutex> lock(state.lock);
+
+	if (state.next == state.results.size())
+		return false;
+
+	state.done_condition.wait(lock, [&state]() {
+		return state.done_order.size() > state.next;
+	});
+
+	index = state.done_order[state.next++];
+	return true;
+}
+
+liblec::lecnet::tcp::client::batch
+liblec::lecnet::tcp::client::send_batch(const std::vector<std::string>& data,
+	const long& timeout_seconds) {
+	batch requests;
+	auto p_state = requests._p_d->p_state;
+	p_state->results.resize(data.size());
+	p_state->done.resize(data.size(), false);
+	p_state->done_order.reserve(data.size());
+
+	// the requests to send, and the index of the data of each
+	std::vector<unsigned long> message_ids;
+	std::vector<size_t> indices;
+	message_ids.reserve(data.size());
+	indices.reserve(data.size());
+	size_t frames_length = 0;
+
+	for (size_t i = 0; i < data.size(); i++) {
+		request_result result;
+
+		if (data[i].empty()) {
+			// there's nothing to send without data
+			result.error = "No data to send";
+			p_state->finish(i, std::move(result));
+			continue;
+		}
+
+		if (!frame_header::fits(data[i].length())) {
+			result.error = "Data too large to send";
+			p_state->finish(i, std::move(result));
+			continue;
+		}
+
+		const unsigned long message_id = _d.add_request([p_state, i](received_data& received) {
+			p_state->finish(i, impl::outcome(received));
+		});
+
+		if (message_id == 0) {
+			result.error = "Not connected to server";
+			p_state->finish(i, std::move(result));
+			continue;
+		}
+
+		message_ids.push_back(message_id);
+		indices.push_back(i);
+		frames_length += frame_header::size + data[i].length();
+	}
+
+	if (message_ids.empty())
+		return requests;
+
+	try {
+		// all the frames in one buffer, for one write
+		auto p_frames = std::make_shared<std::string>();
+		p_frames->reserve(frames_length);
+
+		for (size_t i = 0; i < message_ids.size(); i++)
+			_d.append_frame(data[indices[i]], message_ids[i], *p_frames);
+
+		outgoing_frame frames;
+		frames.p_shared = p_frames;
+
+		_d.send_requests(message_ids, std::move(frames),
+			timeout_seconds > 0 ? timeout_seconds : 10);	// default to 10 seconds
+	}
+	catch (std::exception& e) {
+		for (auto const& it : message_ids)
+			_d.fail_request(it, "Exception: " + std::string(e.what()));
+	}
+
+	return requests;
+}
+
 void liblec::lecnet::tcp::client::disconnect() {
 	if (running() && _d._p_io_service) {
 		if (_d._p_socket) {
@@ -1000,10 +1800,11 @@ void liblec::lecnet::tcp::client::disconnect() {
 		}
 	}
 
-	// wait for the actual disconnection to be registered before exiting
+	// wait for the actual disconnection to be registered before exiting; the client thread
+	// registers it on its way out
 	std::string error;
-	while (connected(error))
-		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	if (connected(error) && _d._fut.valid())
+		_d._fut.wait();
 }
 
 void liblec::lecnet::tcp::client::traffic(liblec::lecnet::network_traffic& traffic) {
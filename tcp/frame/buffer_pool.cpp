@@ -0,0 +1,99 @@
+//
+// buffer_pool.cpp - read buffer pool implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "buffer_pool.h"
+
+buffer_pool::buffer::buffer(buffer&& other) noexcept :
+	_p_pool(other._p_pool),
+	_data(std::move(other._data)),
+	_size_class(other._size_class) {
+	other._p_pool = nullptr;
+}
+
+buffer_pool::buffer& buffer_pool::buffer::operator=(buffer&& other) noexcept {
+	if (this != &other) {
+		release();
+		_p_pool = other._p_pool;
+		_data = std::move(other._data);
+		_size_class = other._size_class;
+		other._p_pool = nullptr;
+	}
+
+	return *this;
+}
+
+buffer_pool::buffer::~buffer() {
+	release();
+}
+
+char* buffer_pool::buffer::data() const {
+	return _data.get();
+}
+
+size_t buffer_pool::buffer::size() const {
+	return _data ? class_size(_size_class) : 0;
+}
+
+buffer_pool::buffer::operator bool() const {
+	return _data != nullptr;
+}
+
+void buffer_pool::buffer::release() {
+	if (_p_pool && _data)
+		_p_pool->put(std::move(_data), _size_class);
+
+	_p_pool = nullptr;
+	_data.reset();
+}
+
+buffer_pool::buffer_pool() {}
+buffer_pool::~buffer_pool() {}
+
+size_t buffer_pool::class_size(size_t size_class) {
+	// 1 KB, 4 KB, 16 KB, 64 KB
+	return size_t(min_size) << (2 * size_class);
+}
+
+buffer_pool::buffer buffer_pool::get(size_t size) {
+	size_t index = 0;
+
+	while (index < size_classes - 1 && class_size(index) < size)
+		index++;
+
+	buffer b;
+	b._p_pool = this;
+	b._size_class = index;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_classes[index].lock);
+		auto& free = _classes[index].free;
+
+		if (!free.empty()) {
+			b._data = std::move(free.back());
+			free.pop_back();
+		}
+	}
+
+	if (!b._data)
+		b._data.reset(new char[class_size(index)]);
+
+	return b;
+}
+
+void buffer_pool::put(std::unique_ptr<char[]> data,
+	size_t size_class) {
+	std::lock_guard<std::mutex> lock(_classes[size_class].lock);
+	auto& free = _classes[size_class].free;
+
+	// keep the buffer for reuse unless enough of this size are being kept already
+	if ((free.size() + 1) * class_size(size_class) <= max_cached_bytes)
+		free.push_back(std::move(data));
+}
@@ -0,0 +1,93 @@
+//
+// buffer_pool.h - read buffer pool interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// A pool of read buffers in a few size classes, shared by the connections of an I/O thread (or
+/// of a client).
+/// </summary>
+///
+/// <remarks>
+/// Connections take a buffer only while data is actually arriving and give it back as soon as
+/// the data has been decoded, so an idle connection holds no read buffer at all. Buffers that
+/// are given back are kept for reuse, up to a limit per size class. Thread safe.
+/// </remarks>
+class buffer_pool {
+public:
+	enum { min_size = 1024, max_size = 1024 * 64 };
+
+	/// <summary>
+	/// A buffer taken from the pool. It goes back to the pool when released or destroyed.
+	/// </summary>
+	class buffer {
+	public:
+		buffer() = default;
+		buffer(buffer&& other) noexcept;
+		buffer& operator=(buffer&& other) noexcept;
+		~buffer();
+
+		char* data() const;
+		size_t size() const;
+		explicit operator bool() const;
+
+		/// <summary>
+		/// Give the buffer back to the pool.
+		/// </summary>
+		void release();
+
+	private:
+		friend class buffer_pool;
+
+		buffer_pool* _p_pool = nullptr;
+		std::unique_ptr<char[]> _data;
+		size_t _size_class = 0;
+
+		buffer(const buffer&) = delete;
+		buffer& operator=(const buffer&) = delete;
+	};
+
+	buffer_pool();
+	~buffer_pool();
+
+	/// <summary>
+	/// Get a buffer.
+	/// </summary>
+	///
+	/// <param name="size">
+	/// The size wanted. It is rounded up to the nearest size class, and capped at max_size.
+	/// </param>
+	buffer get(size_t size);
+
+private:
+	void put(std::unique_ptr<char[]> data,
+		size_t size_class);
+
+	enum { size_classes = 4 };
+
+	// the most memory kept for reuse in each size class
+	enum { max_cached_bytes = 1024 * 1024 };
+
+	struct alignas(64) size_class {
+		std::mutex lock;
+		std::vector<std::unique_ptr<char[]>> free;
+	};
+
+	size_class _classes[size_classes];
+
+	static size_t class_size(size_t size_class);
+
+	buffer_pool(const buffer_pool&) = delete;
+	buffer_pool& operator=(const buffer_pool&) = delete;
+};
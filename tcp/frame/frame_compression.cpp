@@ -0,0 +1,495 @@
+//
+// frame_compression.cpp - tcp/ip frame compression implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "frame_compression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+
+// the codecs are built in if their headers can be found
+#if defined(__has_include)
+	#if __has_include(<lz4.h>)
+		#include <lz4.h>
+		#define LECNET_LZ4
+	#endif
+
+	#if __has_include(<zstd.h>)
+		#include <zstd.h>
+		#define LECNET_ZSTD
+
+		#if __has_include(<zdict.h>)
+			#include <zdict.h>
+			#define LECNET_ZDICT
+		#endif
+	#endif
+#endif
+
+#if defined(_WIN32)
+	#if defined(LECNET_LZ4)
+		#pragma comment(lib, "lz4.lib")
+	#endif
+
+	#if defined(LECNET_ZSTD)
+		#pragma comment(lib, "zstd.lib")
+	#endif
+#endif
+
+namespace {
+	const size_t prefix_size = sizeof(unsigned long);
+	const size_t id_size = sizeof(unsigned long);
+
+	/// <summary>
+	/// The most a payload can decompress to, going by the format of the codec, so that the
+	/// original length sent along with it can't make the receiver allocate more than that.
+	/// </summary>
+	size_t max_decompressed_length(frame_compression::codec c,
+		size_t compressed_length) {
+		size_t units = 0;
+		size_t unit_length = 0;
+
+		switch (c) {
+		case frame_compression::codec::lz4:
+			// every byte of an lz4 block expands to at most 255
+			units = compressed_length + 1;
+			unit_length = 255;
+			break;
+
+		case frame_compression::codec::zstd:
+			// the smallest zstd block, a 3 byte header and a byte to repeat, expands to at
+			// most a whole block of 128 KiB
+			units = compressed_length / 4 + 1;
+			unit_length = 128 * 1024;
+			break;
+
+		default:
+			return 0;
+		}
+
+		// saturated rather than wrapped where size_t is 32 bits
+		return units > std::numeric_limits<size_t>::max() / unit_length ?
+			std::numeric_limits<size_t>::max() : units * unit_length;
+	}
+
+#if defined(LECNET_ZSTD)
+	// the zstd default, which is already much faster than zlib's
+	const int zstd_level = 3;
+
+	/// <summary>
+	/// The zstd contexts of the calling thread, so that every frame doesn't have to allocate
+	/// its own.
+	/// </summary>
+	struct zstd_contexts {
+		std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> p_compress{ ZSTD_createCCtx(),
+			ZSTD_freeCCtx };
+		std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> p_decompress{ ZSTD_createDCtx(),
+			ZSTD_freeDCtx };
+	};
+
+	zstd_contexts& contexts() {
+		thread_local zstd_contexts c;
+		return c;
+	}
+#endif
+}
+
+frame_compression::dictionary::dictionary(unsigned long id,
+	std::string_view data) :
+	_id(id) {
+#if defined(LECNET_ZSTD)
+	if (!data.empty()) {
+		_p_compress = ZSTD_createCDict(data.data(), data.length(), zstd_level);
+		_p_decompress = ZSTD_createDDict(data.data(), data.length());
+	}
+#else
+	(void)data;
+#endif
+}
+
+frame_compression::dictionary::~dictionary() {
+#if defined(LECNET_ZSTD)
+	ZSTD_freeCDict(static_cast<ZSTD_CDict*>(_p_compress));
+	ZSTD_freeDDict(static_cast<ZSTD_DDict*>(_p_decompress));
+#endif
+}
+
+bool frame_compression::dictionary::usable() const {
+	return _p_compress && _p_decompress;
+}
+
+frame_compression::dictionaries
+frame_compression::prepare(const std::vector<liblec::lecnet::tcp::compression_dictionary>& list) {
+	dictionaries prepared;
+
+	for (auto const& it : list) {
+		if (it.id == 0 || std::any_of(prepared.begin(), prepared.end(),
+			[&it](const dictionary_ptr& p) { return p->id() == it.id; }))
+			continue;
+
+		auto p_dictionary = std::make_shared<const dictionary>(it.id, it.data);
+
+		if (p_dictionary->usable())
+			prepared.push_back(p_dictionary);
+	}
+
+	return prepared;
+}
+
+bool frame_compression::train(const std::vector<std::string>& samples,
+	size_t capacity,
+	std::string& dictionary,
+	std::string& error) {
+	dictionary.clear();
+
+#if defined(LECNET_ZDICT)
+	if (samples.empty() || capacity == 0) {
+		error = "No samples to train the dictionary on";
+		return false;
+	}
+
+	// the samples go to zstd one after the other, with their sizes alongside
+	std::vector<size_t> sizes;
+	sizes.reserve(samples.size());
+
+	for (auto const& it : samples)
+		sizes.push_back(it.length());
+
+	std::string joined;
+	joined.reserve(std::accumulate(sizes.begin(), sizes.end(), size_t(0)));
+
+	for (auto const& it : samples)
+		joined.append(it);
+
+	dictionary.resize(capacity);
+	const size_t result = ZDICT_trainFromBuffer(&dictionary[0], capacity, joined.data(),
+		sizes.data(), static_cast<unsigned>(sizes.size()));
+
+	if (ZDICT_isError(result)) {
+		dictionary.clear();
+		error = "Training the dictionary failed: " + std::string(ZDICT_getErrorName(result));
+		return false;
+	}
+
+	dictionary.resize(result);
+	return true;
+#else
+	(void)samples;
+	(void)capacity;
+	error = "Compression dictionaries are not supported by this build";
+	return false;
+#endif
+}
+
+bool frame_compression::supported(codec c) {
+	switch (c) {
+#if defined(LECNET_LZ4)
+	case codec::lz4:
+		return true;
+#endif
+
+#if defined(LECNET_ZSTD)
+	case codec::zstd:
+		return true;
+#endif
+
+	default:
+		return false;
+	}
+}
+
+bool frame_compression::compress(codec c,
+	const dictionary* p_dictionary,
+	std::string_view data,
+	std::string& compressed) {
+#if !defined(LECNET_ZSTD)
+	(void)p_dictionary;
+#endif
+
+	compressed.clear();
+
+	if (!supported(c) || data.empty() ||
+		data.length() > std::numeric_limits<unsigned long>::max())
+		return false;
+
+	const unsigned long length = static_cast<unsigned long>(data.length());
+	size_t bound = 0;
+
+	switch (c) {
+#if defined(LECNET_LZ4)
+	case codec::lz4:
+		if (data.length() > LZ4_MAX_INPUT_SIZE)
+			return false;
+
+		bound = static_cast<size_t>(LZ4_compressBound(static_cast<int>(data.length())));
+		break;
+#endif
+
+#if defined(LECNET_ZSTD)
+	case codec::zstd:
+		bound = ZSTD_compressBound(data.length());
+		break;
+#endif
+
+	default:
+		return false;
+	}
+
+	compressed.resize(prefix_size + bound);
+	memcpy(&compressed[0], &length, prefix_size);
+	size_t written = 0;
+
+	switch (c) {
+#if defined(LECNET_LZ4)
+	case codec::lz4: {
+		const int result = LZ4_compress_default(data.data(), &compressed[prefix_size],
+			static_cast<int>(data.length()), static_cast<int>(bound));
+
+		if (result > 0)
+			written = static_cast<size_t>(result);
+	} break;
+#endif
+
+#if defined(LECNET_ZSTD)
+	case codec::zstd: {
+		ZSTD_CCtx* p_context = contexts().p_compress.get();
+
+		// the original length is sent ahead of the data, and the dictionary is agreed on
+		// beforehand, so neither is repeated in the zstd frame; it matters with small payloads
+		ZSTD_CCtx_reset(p_context, ZSTD_reset_session_and_parameters);
+		ZSTD_CCtx_setParameter(p_context, ZSTD_c_compressionLevel, zstd_level);
+		ZSTD_CCtx_setParameter(p_context, ZSTD_c_contentSizeFlag, 0);
+		ZSTD_CCtx_setParameter(p_context, ZSTD_c_dictIDFlag, 0);
+
+		if (p_dictionary)
+			ZSTD_CCtx_refCDict(p_context,
+				static_cast<const ZSTD_CDict*>(p_dictionary->_p_compress));
+
+		const size_t result = ZSTD_compress2(p_context, &compressed[prefix_size], bound,
+			data.data(), data.length());
+
+		if (!ZSTD_isError(result))
+			written = result;
+	} break;
+#endif
+
+	default:
+		break;
+	}
+
+	// not worth it
+	if (written == 0 || prefix_size + written >= data.length()) {
+		compressed.clear();
+		return false;
+	}
+
+	compressed.resize(prefix_size + written);
+	return true;
+}
+
+bool frame_compression::original_length(std::string_view compressed,
+	size_t& length) {
+	if (compressed.length() < prefix_size)
+		return false;
+
+	unsigned long original = 0;
+	memcpy(&original, compressed.data(), prefix_size);
+	length = original;
+	return true;
+}
+
+bool frame_compression::decompress(codec c,
+	const dictionary* p_dictionary,
+	std::string_view compressed,
+	std::string& data,
+	std::string& error) {
+#if !defined(LECNET_ZSTD)
+	(void)p_dictionary;
+#endif
+
+	data.clear();
+	size_t length = 0;
+
+	if (!supported(c) || !original_length(compressed, length)) {
+		error = "Invalid compressed data received";
+		return false;
+	}
+
+	compressed.remove_prefix(prefix_size);
+
+	// the length comes from the peer, so it's only believed as far as the codec allows
+	if (length > max_decompressed_length(c, compressed.length())) {
+		error = "Invalid compressed data received";
+		return false;
+	}
+
+	try {
+		data.resize(length);
+	}
+	catch (std::bad_alloc&) {
+		error = "Not enough memory to decompress the data received";
+		return false;
+	}
+	catch (std::length_error&) {
+		error = "Invalid compressed data received";
+		return false;
+	}
+
+	bool decompressed = false;
+
+	switch (c) {
+#if defined(LECNET_LZ4)
+	case codec::lz4:
+		if (length <= LZ4_MAX_INPUT_SIZE && compressed.length() <= LZ4_MAX_INPUT_SIZE)
+			decompressed = LZ4_decompress_safe(compressed.data(), &data[0],
+				static_cast<int>(compressed.length()), static_cast<int>(length)) ==
+				static_cast<int>(length);
+		break;
+#endif
+
+#if defined(LECNET_ZSTD)
+	case codec::zstd: {
+		const size_t result = p_dictionary ?
+			ZSTD_decompress_usingDDict(contexts().p_decompress.get(), &data[0], length,
+				compressed.data(), compressed.length(),
+				static_cast<const ZSTD_DDict*>(p_dictionary->_p_decompress)) :
+			ZSTD_decompressDCtx(contexts().p_decompress.get(), &data[0], length,
+				compressed.data(), compressed.length());
+
+		decompressed = !ZSTD_isError(result) && result == length;
+	} break;
+#endif
+
+	default:
+		break;
+	}
+
+	if (!decompressed) {
+		data.clear();
+		error = "Invalid compressed data received";
+		return false;
+	}
+
+	return true;
+}
+
+std::string frame_compression::offer(const std::vector<codec>& codecs,
+	const dictionaries& available) {
+	std::string supported_codecs;
+
+	for (auto const& it : codecs)
+		if (supported(it) && supported_codecs.length() < std::numeric_limits<unsigned char>::max())
+			supported_codecs.push_back(static_cast<char>(it));
+
+	std::string payload(1, static_cast<char>(control::codecs));
+	payload.push_back(static_cast<char>(supported_codecs.length()));
+	payload.append(supported_codecs);
+
+	for (auto const& it : available) {
+		const unsigned long id = it->id();
+		payload.append(reinterpret_cast<const char*>(&id), id_size);
+	}
+
+	return payload;
+}
+
+frame_compression::codec frame_compression::choose(std::string_view offer,
+	const std::vector<codec>& accepted,
+	const dictionaries& available,
+	dictionary_ptr& p_dictionary) {
+	p_dictionary = nullptr;
+
+	if (offer.length() < 2 || offer[0] != static_cast<char>(control::codecs))
+		return codec::none;
+
+	const size_t count = static_cast<unsigned char>(offer[1]);
+
+	if (offer.length() < 2 + count)
+		return codec::none;
+
+	const std::string_view codecs = offer.substr(2, count);
+	std::string_view ids = offer.substr(2 + codecs.length());
+	codec picked = codec::none;
+
+	for (auto const& it : codecs) {
+		const codec c = static_cast<codec>(it);
+
+		if (supported(c) && std::find(accepted.begin(), accepted.end(), c) != accepted.end()) {
+			picked = c;
+			break;
+		}
+	}
+
+	// only zstd takes a dictionary
+	if (picked != codec::zstd)
+		return picked;
+
+	for (; ids.length() >= id_size; ids.remove_prefix(id_size)) {
+		unsigned long id = 0;
+		memcpy(&id, ids.data(), id_size);
+
+		auto it = std::find_if(available.begin(), available.end(),
+			[id](const dictionary_ptr& p) { return p->id() == id; });
+
+		if (it != available.end()) {
+			p_dictionary = *it;
+			break;
+		}
+	}
+
+	return picked;
+}
+
+std::string frame_compression::answer(codec c,
+	const dictionary_ptr& p_dictionary) {
+	std::string payload(1, static_cast<char>(control::codecs));
+	payload.push_back(static_cast<char>(c));
+
+	if (p_dictionary) {
+		const unsigned long id = p_dictionary->id();
+		payload.append(reinterpret_cast<const char*>(&id), id_size);
+	}
+
+	return payload;
+}
+
+frame_compression::codec frame_compression::chosen(std::string_view answer,
+	const dictionaries& available,
+	dictionary_ptr& p_dictionary) {
+	p_dictionary = nullptr;
+
+	if ((answer.length() != 2 && answer.length() != 2 + id_size) ||
+		answer[0] != static_cast<char>(control::codecs))
+		return codec::none;
+
+	const codec c = static_cast<codec>(answer[1]);
+
+	if (!supported(c))
+		return codec::none;
+
+	if (answer.length() > 2) {
+		unsigned long id = 0;
+		memcpy(&id, answer.data() + 2, id_size);
+
+		auto it = std::find_if(available.begin(), available.end(),
+			[id](const dictionary_ptr& p) { return p->id() == id; });
+
+		// not a dictionary this client offered
+		if (it == available.end())
+			return codec::none;
+
+		p_dictionary = *it;
+	}
+
+	return c;
+}
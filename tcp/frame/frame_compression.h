@@ -0,0 +1,217 @@
+//
+// frame_compression.h - tcp/ip frame compression interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include "../../tcp.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// <summary>
+/// Compressing frame payloads, and negotiating the codec to compress them with.
+/// </summary>
+///
+/// <remarks>
+/// A compressed payload is the length of the original payload, as an unsigned long, followed by
+/// the payload as compressed by the codec, and is sent with frame_decoder::compressed_flag set.
+/// Which codec that is is agreed on once per connection: the client sends a control frame
+/// (frame_decoder::control_flag) offering the codecs it can use, in order of preference, and
+/// the IDs of the dictionaries it has, and the server answers with a control frame naming the
+/// codec it picked, if any, and the dictionary to use with it, if any. Either side only
+/// compresses once the codec is agreed on, and a payload that doesn't get any smaller is sent
+/// as it is. The codecs are only available if their headers were found when the library was
+/// built, and dictionaries only with zstd.
+///
+/// The offer is control::codecs, the number of codecs, the codecs, then the dictionary IDs as
+/// unsigned longs. The answer is control::codecs, the codec, then the dictionary ID if there is
+/// one.
+/// </remarks>
+namespace frame_compression {
+	typedef liblec::lecnet::tcp::compression codec;
+
+	/// <summary>
+	/// The kinds of control frame.
+	/// </summary>
+	enum class control : char {
+		codecs = 'C',
+	};
+
+	class dictionary;
+	typedef std::shared_ptr<const dictionary> dictionary_ptr;
+	typedef std::vector<dictionary_ptr> dictionaries;
+
+	/// <summary>
+	/// A zstd dictionary, prepared once for compressing and decompressing with. It can be used
+	/// from any number of threads at the same time.
+	/// </summary>
+	class dictionary {
+	public:
+		dictionary(unsigned long id,
+			std::string_view data);
+		~dictionary();
+
+		unsigned long id() const { return _id; }
+
+		/// <summary>
+		/// Check whether the dictionary could be prepared.
+		/// </summary>
+		bool usable() const;
+
+	private:
+		friend bool compress(codec c,
+			const dictionary* p_dictionary,
+			std::string_view data,
+			std::string& compressed);
+
+		friend bool decompress(codec c,
+			const dictionary* p_dictionary,
+			std::string_view compressed,
+			std::string& data,
+			std::string& error);
+
+		const unsigned long _id;
+
+		// the zstd dictionaries, left opaque so that zstd's header isn't needed here
+		void* _p_compress = nullptr;
+		void* _p_decompress = nullptr;
+
+		dictionary(const dictionary&) = delete;
+		dictionary& operator=(const dictionary&) = delete;
+	};
+
+	/// <summary>
+	/// Prepare the dictionaries given in the client or server parameters. Those with an ID of
+	/// 0, with the ID of one before them, or that can't be prepared, e.g. because zstd wasn't
+	/// built in, are left out.
+	/// </summary>
+	dictionaries prepare(const std::vector<liblec::lecnet::tcp::compression_dictionary>& list);
+
+	/// <summary>
+	/// Train a zstd dictionary on samples of the payloads it's meant for.
+	/// </summary>
+	///
+	/// <param name="capacity">
+	/// The largest the dictionary can be, in bytes.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns true if successful, else false.
+	/// </returns>
+	bool train(const std::vector<std::string>& samples,
+		size_t capacity,
+		std::string& dictionary,
+		std::string& error);
+
+	/// <summary>
+	/// Check whether a codec was built in.
+	/// </summary>
+	bool supported(codec c);
+
+	/// <summary>
+	/// Compress a payload.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns true if the payload was compressed, else false if it should be sent as it is,
+	/// e.g. if it didn't get any smaller.
+	/// </returns>
+	///
+	/// <param name="p_dictionary">
+	/// The dictionary to compress with, or nullptr for none. Only used with zstd.
+	/// </param>
+	bool compress(codec c,
+		const dictionary* p_dictionary,
+		std::string_view data,
+		std::string& compressed);
+
+	/// <summary>
+	/// Get the length a payload will have once it's decompressed, without decompressing it.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns false if the payload is too short to be a compressed one.
+	/// </returns>
+	bool original_length(std::string_view compressed,
+		size_t& length);
+
+	/// <summary>
+	/// Decompress a payload.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns true if successful, else false, e.g. if the payload is corrupt, claims to be
+	/// larger than the codec could have made it, or there isn't the memory for it.
+	/// </returns>
+	///
+	/// <param name="p_dictionary">
+	/// The dictionary the payload was compressed with, or nullptr for none.
+	/// </param>
+	bool decompress(codec c,
+		const dictionary* p_dictionary,
+		std::string_view compressed,
+		std::string& data,
+		std::string& error);
+
+	/// <summary>
+	/// Make the payload of a client's control frame offering the given codecs and dictionaries.
+	/// Codecs that weren't built in are left out.
+	/// </summary>
+	std::string offer(const std::vector<codec>& codecs,
+		const dictionaries& available);
+
+	/// <summary>
+	/// Pick a codec out of those offered by a client, in the client's order of preference, and
+	/// with zstd the first dictionary offered that the server has too.
+	/// </summary>
+	///
+	/// <param name="accepted">
+	/// The codecs the server is willing to use.
+	/// </param>
+	///
+	/// <param name="available">
+	/// The server's dictionaries.
+	/// </param>
+	///
+	/// <param name="p_dictionary">
+	/// The dictionary picked, or nullptr if none was.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns the codec picked, or codec::none if none of them will do.
+	/// </returns>
+	codec choose(std::string_view offer,
+		const std::vector<codec>& accepted,
+		const dictionaries& available,
+		dictionary_ptr& p_dictionary);
+
+	/// <summary>
+	/// Make the payload of a server's control frame answering an offer.
+	/// </summary>
+	std::string answer(codec c,
+		const dictionary_ptr& p_dictionary);
+
+	/// <summary>
+	/// Read the codec and dictionary out of a server's answer.
+	/// </summary>
+	///
+	/// <param name="available">
+	/// The client's dictionaries.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns the codec, or codec::none if the answer can't be made sense of.
+	/// </returns>
+	codec chosen(std::string_view answer,
+		const dictionaries& available,
+		dictionary_ptr& p_dictionary);
+}
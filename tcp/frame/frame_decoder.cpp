@@ -0,0 +1,185 @@
+//
+// frame_decoder.cpp - tcp/ip frame decoder implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "frame_decoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+frame_decoder::frame_decoder(unsigned long magic_number,
+	size_t max_frame_size) :
+	_magic_number(magic_number),
+	_max_frame_size(max_frame_size) {}
+
+void frame_decoder::reset(unsigned long magic_number) {
+	_magic_number = magic_number;
+	_header_filled = 0;
+	_message_id = 0;
+	_flags = 0;
+	_payload_length = 0;
+	_payload.clear();
+	_payload_filled = 0;
+	_in_payload = false;
+	_blocked = false;
+	_held.clear();
+}
+
+bool frame_decoder::feed(const char* data,
+	size_t length,
+	const frame_handler& on_frame,
+	std::string& error) {
+	if (_blocked) {
+		_held.append(data, length);
+		return true;
+	}
+
+	while (length > 0) {
+		if (!_in_payload) {
+			// fill the header
+			const size_t n = std::min(length, header_size - _header_filled);
+			memcpy(_header + _header_filled, data, n);
+			_header_filled += n;
+			data += n;
+			length -= n;
+
+			if (_header_filled < header_size)
+				break;
+
+			unsigned long magic_number = 0;
+			unsigned long frame_length = 0;
+			memcpy(&magic_number, _header, sizeof(unsigned long));
+			memcpy(&_message_id, _header + sizeof(unsigned long), sizeof(unsigned long));
+			memcpy(&frame_length, _header + 2 * sizeof(unsigned long), sizeof(unsigned long));
+
+			_flags = frame_length & ~length_mask;
+			frame_length &= length_mask;
+
+			if (magic_number != _magic_number || frame_length < header_size) {
+				error = "Invalid data received";
+				return false;
+			}
+
+			// reject an oversize frame before anything is allocated for it
+			if (_max_frame_size > 0 && frame_length > _max_frame_size) {
+				error = "Frame too large";
+				return false;
+			}
+
+			_payload_length = frame_length - header_size;
+
+			if (length >= _payload_length) {
+				// the whole payload is here; hand it over where it is
+				_header_filled = 0;
+
+				frame f{ _message_id, (_flags & compressed_flag) != 0,
+					(_flags & control_flag) != 0, std::string_view(data, _payload_length),
+					nullptr };
+				data += _payload_length;
+				length -= _payload_length;
+
+				on_frame(f);
+				continue;
+			}
+
+			if (!start_payload()) {
+				// hold on to the rest of the data until the memory for the payload is given
+				_held.assign(data, length);
+				break;
+			}
+		}
+		else {
+			// fill the payload
+			const size_t n = std::min(length, _payload.length() - _payload_filled);
+			memcpy(&_payload[_payload_filled], data, n);
+			data += n;
+			length -= n;
+
+			commit(n, on_frame);
+		}
+	}
+
+	return true;
+}
+
+void frame_decoder::set_reserve_handler(reserve_handler on_reserve) {
+	_on_reserve = on_reserve;
+}
+
+bool frame_decoder::blocked() const {
+	return _blocked;
+}
+
+bool frame_decoder::resume(const frame_handler& on_frame,
+	std::string& error) {
+	if (!_blocked)
+		return true;
+
+	_blocked = false;
+
+	if (!start_payload())
+		return true;
+
+	std::string held;
+	held.swap(_held);
+	return feed(held.data(), held.length(), on_frame, error);
+}
+
+bool frame_decoder::start_payload() {
+	if (_on_reserve && !_on_reserve(_payload_length)) {
+		_blocked = true;
+		return false;
+	}
+
+	// allocate the payload once, at its exact size
+	_payload.resize(_payload_length);
+	_payload_filled = 0;
+	_in_payload = true;
+	return true;
+}
+
+bool frame_decoder::payload_buffer(char*& buffer,
+	size_t& size) {
+	if (!_in_payload)
+		return false;
+
+	buffer = &_payload[_payload_filled];
+	size = _payload.length() - _payload_filled;
+	return true;
+}
+
+void frame_decoder::commit(size_t length,
+	const frame_handler& on_frame) {
+	_payload_filled += length;
+	complete_payload(on_frame);
+}
+
+bool frame_decoder::partial() const {
+	return _header_filled > 0 || _in_payload;
+}
+
+bool frame_decoder::header_partial() const {
+	return _header_filled > 0 && _header_filled < header_size;
+}
+
+void frame_decoder::complete_payload(const frame_handler& on_frame) {
+	if (!_in_payload || _payload_filled < _payload.length())
+		return;
+
+	// the frame is complete; get ready for the next one before handing this one over
+	std::string payload;
+	payload.swap(_payload);
+	_header_filled = 0;
+	_payload_filled = 0;
+	_in_payload = false;
+
+	frame f{ _message_id, (_flags & compressed_flag) != 0, (_flags & control_flag) != 0,
+		std::string_view(payload), &payload };
+	on_frame(f);
+}
@@ -0,0 +1,189 @@
+//
+// frame_decoder.h - tcp/ip frame decoder interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+
+/// <summary>
+/// Incremental decoder for the frames exchanged by the tcp client and servers.
+/// </summary>
+///
+/// <remarks>
+/// A frame is a header of three unsigned longs (the magic number, the message ID and the length
+/// of the whole frame, header included) followed by the payload. The top two bits of the length
+/// are flags, for a payload that is compressed and for a frame that is part of the connection's
+/// own protocol (e.g. negotiating a codec) rather than data. Data can be fed to the decoder
+/// in chunks of any size: a chunk can end part way through a header or payload, or hold several
+/// frames. A frame that arrives whole within one chunk is handed over as a view into that chunk,
+/// without being copied at all; otherwise its payload is allocated once, at its exact size, as
+/// soon as its header is complete, and only once a <see cref="reserve_handler"/> (if any) has
+/// agreed to the memory being used.
+/// </remarks>
+class frame_decoder {
+public:
+	/// <summary>
+	/// A complete frame.
+	/// </summary>
+	struct frame {
+		unsigned long message_id;
+		bool compressed;
+		bool control;
+
+		/// <summary>
+		/// The payload. Only valid for the duration of the call to the frame handler.
+		/// </summary>
+		std::string_view payload;
+
+		/// <summary>
+		/// The string the payload is in, which can be moved from, or nullptr if the payload is
+		/// a view into the data fed to the decoder.
+		/// </summary>
+		std::string* p_owned;
+
+		/// <summary>
+		/// Take the payload, copying it only if it isn't already in a string of its own.
+		/// </summary>
+		std::string take() {
+			return p_owned ? std::move(*p_owned) : std::string(payload);
+		}
+	};
+
+	/// <summary>
+	/// Called for every complete frame.
+	/// </summary>
+	typedef std::function<void(frame& f)> frame_handler;
+
+	/// <summary>
+	/// Called before memory is allocated for a payload, with the number of bytes needed.
+	/// Returns false if the memory can't be used yet, in which case the decoder is blocked until
+	/// <see cref="resume"/> is called.
+	/// </summary>
+	typedef std::function<bool(size_t bytes)> reserve_handler;
+
+	enum { header_size = 3 * sizeof(unsigned long) };
+
+	static constexpr unsigned long compressed_flag = 1UL << (8 * sizeof(unsigned long) - 1);
+	static constexpr unsigned long control_flag = compressed_flag >> 1;
+	static constexpr unsigned long length_mask = control_flag - 1;
+
+	/// <param name="max_frame_size">
+	/// The largest frame accepted, header included, or 0 for no limit.
+	/// </param>
+	frame_decoder(unsigned long magic_number = 0,
+		size_t max_frame_size = 0);
+
+	/// <summary>
+	/// Discard any partially decoded frame and set the magic number to expect.
+	/// </summary>
+	void reset(unsigned long magic_number);
+
+	/// <summary>
+	/// Decode received data.
+	/// </summary>
+	///
+	/// <param name="data">
+	/// The data received.
+	/// </param>
+	///
+	/// <param name="length">
+	/// The number of bytes received.
+	/// </param>
+	///
+	/// <param name="on_frame">
+	/// The handler to call for every frame completed by this data.
+	/// </param>
+	///
+	/// <param name="error">
+	/// Error information.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns false if the data is not a valid frame, e.g. if the magic number does not match.
+	/// The stream cannot be recovered from this and the connection should be closed.
+	/// </returns>
+	bool feed(const char* data,
+		size_t length,
+		const frame_handler& on_frame,
+		std::string& error);
+
+	/// <summary>
+	/// Set the handler to call before memory is allocated for a payload.
+	/// </summary>
+	void set_reserve_handler(reserve_handler on_reserve);
+
+	/// <summary>
+	/// Check whether the decoder is waiting for the memory for a payload. Any data fed to a
+	/// blocked decoder is held until it is resumed, so no more should be read meanwhile.
+	/// </summary>
+	bool blocked() const;
+
+	/// <summary>
+	/// Try again to get the memory for the payload the decoder is blocked on and, if it is
+	/// given, decode the data held since.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns false if the data is not a valid frame, as <see cref="feed"/> does.
+	/// </returns>
+	bool resume(const frame_handler& on_frame,
+		std::string& error);
+
+	/// <summary>
+	/// Get the unfilled part of the payload being received, if any, so that the next read can
+	/// go straight into it instead of being copied there by <see cref="feed"/>.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns true if a payload is being received, else false.
+	/// </returns>
+	bool payload_buffer(char*& buffer,
+		size_t& size);
+
+	/// <summary>
+	/// Account for data read straight into the buffer given by <see cref="payload_buffer"/>.
+	/// </summary>
+	void commit(size_t length,
+		const frame_handler& on_frame);
+
+	/// <summary>
+	/// Check whether the decoder is part way through a frame.
+	/// </summary>
+	bool partial() const;
+
+	/// <summary>
+	/// Check whether the decoder is part way through a frame's header.
+	/// </summary>
+	bool header_partial() const;
+
+private:
+	bool start_payload();
+	void complete_payload(const frame_handler& on_frame);
+
+	unsigned long _magic_number;
+	size_t _max_frame_size;
+	reserve_handler _on_reserve;
+
+	char _header[header_size];
+	size_t _header_filled = 0;
+
+	unsigned long _message_id = 0;
+	unsigned long _flags = 0;
+	size_t _payload_length = 0;
+	std::string _payload;
+	size_t _payload_filled = 0;
+	bool _in_payload = false;
+
+	// data received while waiting for the memory for a payload
+	bool _blocked = false;
+	std::string _held;
+};
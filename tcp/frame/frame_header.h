@@ -0,0 +1,94 @@
+//
+// frame_header.h - tcp/ip frame header interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include "frame_decoder.h"
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+
+/// <summary>
+/// The header of an outgoing frame.
+/// </summary>
+///
+/// <remarks>
+/// The header is built in this fixed buffer and written together with the untouched payload as
+/// a buffer sequence, so the payload is never copied just to put the header in front of it.
+/// See <see cref="frame_decoder"/> for the layout.
+/// </remarks>
+struct frame_header {
+	enum { size = frame_decoder::header_size };
+
+	// the largest payload a frame can carry, as the top bits of the length field are flags;
+	// just under 1 GiB where an unsigned long is 32 bits
+	static constexpr size_t max_payload = frame_decoder::length_mask - size;
+
+	char data[size];
+
+	/// <summary>
+	/// Check whether a payload is small enough to be sent in a frame.
+	/// </summary>
+	static bool fits(size_t payload_length) {
+		return payload_length <= max_payload;
+	}
+
+	frame_header() {
+		memset(data, 0, size);
+	}
+
+	/// <param name="flags">
+	/// Any of frame_decoder::compressed_flag and frame_decoder::control_flag.
+	/// </param>
+	frame_header(unsigned long magic_number,
+		unsigned long message_id,
+		size_t payload_length,
+		unsigned long flags = 0) {
+		// anything larger would run into the flags; the senders turn it away beforehand
+		assert(fits(payload_length));
+
+		const unsigned long length = static_cast<unsigned long>(payload_length + size) | flags;
+
+		memcpy(data, &magic_number, sizeof(unsigned long));
+		memcpy(data + sizeof(unsigned long), &message_id, sizeof(unsigned long));
+		memcpy(data + 2 * sizeof(unsigned long), &length, sizeof(unsigned long));
+	}
+
+	/// <summary>
+	/// Get the length of the whole frame, header included.
+	/// </summary>
+	unsigned long frame_length() const {
+		unsigned long length = 0;
+		memcpy(&length, data + 2 * sizeof(unsigned long), sizeof(unsigned long));
+		return length & frame_decoder::length_mask;
+	}
+};
+
+/// <summary>
+/// A frame waiting to be sent.
+/// </summary>
+struct outgoing_frame {
+	frame_header header;
+	std::string payload;
+
+	// whole frames, headers included, that were encoded ahead of time to be sent as they are,
+	// e.g. one that is broadcast on any number of connections, or a client's batch of
+	// requests; the header and payload are unused if it's set
+	std::shared_ptr<const std::string> p_shared;
+
+	/// <summary>
+	/// Get the number of bytes to send, headers included.
+	/// </summary>
+	size_t length() const {
+		return p_shared ? p_shared->length() : frame_header::size + payload.length();
+	}
+};
@@ -0,0 +1,133 @@
+//
+// write_queue.cpp - tcp/ip outgoing frame queue implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "write_queue.h"
+
+#include <algorithm>
+
+void write_queue::push(outgoing_frame&& frame) {
+	_bytes += frame.length();
+
+	if (frame.p_shared)
+		_shared_bytes += frame.length();
+
+	_frames.push_back(std::move(frame));
+}
+
+bool write_queue::empty() const {
+	return _frames.empty();
+}
+
+size_t write_queue::bytes() const {
+	return _bytes;
+}
+
+size_t write_queue::owned_bytes() const {
+	return _bytes - _shared_bytes;
+}
+
+void write_queue::prepare(std::vector<segment>& segments) {
+	segments.clear();
+	_coalesced.clear();
+
+	// work out how many frames go into this batch, and how much of them is to be copied
+	size_t frames = 0;
+	size_t to_copy = 0;
+	size_t segment_count = 0;
+	bool segment_open = false;
+
+	for (auto const& frame : _frames) {
+		size_t copy = 0;
+		size_t count = segment_count + 1;
+		bool small = false;
+
+		// a shared frame is a piece of its own; anything else has at least its header copied
+		if (!frame.p_shared) {
+			small = frame.payload.length() <= coalesce_threshold;
+			copy = frame_header::size + (small ? frame.payload.length() : 0);
+			count = segment_count + (segment_open ? 0 : 1) + (small ? 0 : 1);
+		}
+
+		if (frames > 0 && (to_copy + copy > max_coalesced || count > max_segments))
+			break;
+
+		to_copy += copy;
+		segment_count = count;
+		segment_open = small;
+		frames++;
+	}
+
+	// reserve up front so that the segments pointing into the copy stay valid
+	_coalesced.reserve(to_copy);
+	size_t segment_start = 0;
+
+	for (size_t i = 0; i < frames; i++) {
+		const outgoing_frame& frame = _frames[i];
+
+		if (frame.p_shared) {
+			// close the copied piece, if any, then send the shared frame as it is
+			if (_coalesced.length() > segment_start)
+				segments.push_back({ _coalesced.data() + segment_start,
+					_coalesced.length() - segment_start });
+
+			segments.push_back({ frame.p_shared->data(), frame.p_shared->length() });
+			segment_start = _coalesced.length();
+			continue;
+		}
+
+		_coalesced.append(frame.header.data, frame_header::size);
+
+		if (frame.payload.length() <= coalesce_threshold)
+			_coalesced.append(frame.payload);
+		else {
+			// close the copied piece with this frame's header, then send its payload as it is
+			segments.push_back({ _coalesced.data() + segment_start,
+				_coalesced.length() - segment_start });
+			segments.push_back({ frame.payload.data(), frame.payload.length() });
+			segment_start = _coalesced.length();
+		}
+	}
+
+	if (_coalesced.length() > segment_start)
+		segments.push_back({ _coalesced.data() + segment_start,
+			_coalesced.length() - segment_start });
+
+	_batch_frames = frames;
+}
+
+void write_queue::consume() {
+	const size_t frames = std::min(_batch_frames, _frames.size());
+
+	for (size_t i = 0; i < frames; i++) {
+		_bytes -= _frames[i].length();
+
+		if (_frames[i].p_shared)
+			_shared_bytes -= _frames[i].length();
+	}
+
+	_frames.erase(_frames.begin(), _frames.begin() + frames);
+	_batch_frames = 0;
+
+	if (_frames.empty()) {
+		// nothing left to send; don't hold on to the memory while the connection is idle
+		std::vector<outgoing_frame>().swap(_frames);
+		std::string().swap(_coalesced);
+	}
+	else
+		_coalesced.clear();
+}
+
+void write_queue::clear() {
+	std::vector<outgoing_frame>().swap(_frames);
+	_batch_frames = 0;
+	std::string().swap(_coalesced);
+	_bytes = 0;
+	_shared_bytes = 0;
+}
@@ -0,0 +1,99 @@
+//
+// write_queue.h - tcp/ip outgoing frame queue interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include "frame_header.h"
+
+#include <vector>
+
+/// <summary>
+/// The frames waiting to be sent on a connection.
+/// </summary>
+///
+/// <remarks>
+/// Frames are sent in batches, each with a single gather write. Small frames (and the headers of
+/// large ones) are copied next to each other into one contiguous buffer so that a batch of small
+/// responses goes out in one syscall, or one TLS record, instead of one per frame. Large payloads
+/// and shared frames are never copied. Only one batch can be in progress at a time and this
+/// class is not thread safe; it is meant to be used from within a session's strand.
+/// </remarks>
+class write_queue {
+public:
+	/// <summary>
+	/// A piece of a batch, to be turned into a buffer for the write.
+	/// </summary>
+	struct segment {
+		const char* data;
+		size_t size;
+	};
+
+	/// <summary>
+	/// Add a frame to the back of the queue.
+	/// </summary>
+	void push(outgoing_frame&& frame);
+
+	/// <summary>
+	/// Check whether there are no frames in the queue.
+	/// </summary>
+	bool empty() const;
+
+	/// <summary>
+	/// Get the number of bytes in the queue, headers included, including those of the batch in
+	/// progress.
+	/// </summary>
+	size_t bytes() const;
+
+	/// <summary>
+	/// Get the number of bytes in the queue that belong to it alone, i.e. the same as
+	/// <see cref="bytes"/> but without the shared frames.
+	/// </summary>
+	size_t owned_bytes() const;
+
+	/// <summary>
+	/// Gather the frames at the front of the queue into the next batch.
+	/// </summary>
+	///
+	/// <param name="segments">
+	/// The pieces of the batch, in the order they are to be written. They remain valid until
+	/// <see cref="consume"/> or <see cref="clear"/> is called.
+	/// </param>
+	void prepare(std::vector<segment>& segments);
+
+	/// <summary>
+	/// Remove the frames in the last batch prepared, once it has been written.
+	/// </summary>
+	void consume();
+
+	/// <summary>
+	/// Remove all the frames.
+	/// </summary>
+	void clear();
+
+private:
+	// payloads up to this size are copied into the batch rather than written from where they are
+	enum { coalesce_threshold = 1024 * 4 };
+
+	// the most that is copied into one batch
+	enum { max_coalesced = 1024 * 64 };
+
+	// the most pieces a batch is split into, in line with what a single writev takes
+	enum { max_segments = 64 };
+
+	// a vector rather than a deque since an empty deque still holds memory, which adds up over
+	// many idle connections; the batch in progress only ever points into _coalesced, into
+	// payloads too large for the small string buffer and into shared frames, so it is
+	// unaffected by reallocation
+	std::vector<outgoing_frame> _frames;
+	size_t _batch_frames = 0;
+	std::string _coalesced;
+	size_t _bytes = 0;
+	size_t _shared_bytes = 0;
+};
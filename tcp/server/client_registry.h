@@ -0,0 +1,329 @@
+//
+// client_registry.h - server client registry interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include "../../tcp.h"
+#include "../../auto_mutex/auto_mutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/// <summary>
+/// Traffic counters for one connection, in bytes.
+/// </summary>
+///
+/// <remarks>
+/// Padded to a cache line of its own so that sessions updating their counters on different
+/// threads never invalidate each other's cache lines. Updated without any lock.
+/// </remarks>
+struct alignas(64) traffic_counters {
+	std::atomic<unsigned long long> in{ 0 };
+	std::atomic<unsigned long long> out{ 0 };
+
+	void append_in(size_t length) {
+		in.fetch_add(length, std::memory_order_relaxed);
+	}
+
+	void append_out(size_t length) {
+		out.fetch_add(length, std::memory_order_relaxed);
+	}
+};
+
+/// <summary>
+/// The clients connected to a server, keyed by a connection ID.
+/// </summary>
+///
+/// <remarks>
+/// Each server instance has its own registry. The registry is split into shards, each with its
+/// own lock, and a connection always lives in shard (id % number of shards) so sessions on
+/// different shards never contend for the same lock. Sessions only take a lock when they are
+/// added and removed; their traffic is counted in their own traffic_counters and aggregated
+/// when it is asked for. Each shard also indexes the connections whose address hashes to it, so
+/// that a client can be found by address without searching all the shards.
+/// </remarks>
+template <typename session>
+class client_registry {
+public:
+	typedef unsigned long long connection_id;
+	typedef liblec::lecnet::tcp::server::client_address client_address;
+	typedef liblec::lecnet::tcp::server::client_info client_info;
+
+	client_registry() {
+		_shards.push_back(std::make_unique<shard>());
+	}
+
+	/// <summary>
+	/// Clear the registry and split it into the given number of shards.
+	/// </summary>
+	///
+	/// <remarks>
+	/// Only call this while no sessions exist, i.e. before the server starts.
+	/// </remarks>
+	void reset(size_t shards) {
+		// the server's total traffic outlives restarts
+		liblec::lecnet::network_traffic total;
+		traffic(total);
+
+		_shards.clear();
+
+		for (size_t i = 0; i < std::max(shards, size_t(1)); i++)
+			_shards.push_back(std::make_unique<shard>());
+
+		_shards.front()->traffic = total;
+		_count = 0;
+	}
+
+	/// <summary>
+	/// Add a client.
+	/// </summary>
+	///
+	/// <param name="p_traffic">
+	/// The client's traffic counters. They must remain valid until the client is removed.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns the client's connection ID.
+	/// </returns>
+	connection_id add(const client_address& address,
+		std::weak_ptr<session> p_session,
+		const traffic_counters* p_traffic) {
+		const connection_id id = _next_id++;
+		shard& s = get_shard(id);
+
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(s.lock);
+			entry& e = s.clients[id];
+			e.address = address;
+			e.p_session = p_session;
+			e.p_traffic = p_traffic;
+		}
+
+		// it's essential to limit the scope of this mutex
+		{
+			shard& a = get_address_shard(address);
+			liblec::auto_mutex lock(a.lock);
+			a.addresses[address] = id;
+		}
+
+		_count++;
+		return id;
+	}
+
+	/// <summary>
+	/// Remove a client. The client's traffic is added to that of the clients that have
+	/// already disconnected.
+	/// </summary>
+	void remove(connection_id id) {
+		shard& s = get_shard(id);
+		client_address address;
+
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(s.lock);
+			auto it = s.clients.find(id);
+
+			if (it == s.clients.end())
+				return;
+
+			s.traffic.in += it->second.p_traffic->in.load(std::memory_order_relaxed);
+			s.traffic.out += it->second.p_traffic->out.load(std::memory_order_relaxed);
+			address = std::move(it->second.address);
+			s.clients.erase(it);
+		}
+
+		// it's essential to limit the scope of this mutex
+		{
+			shard& a = get_address_shard(address);
+			liblec::auto_mutex lock(a.lock);
+			auto it = a.addresses.find(address);
+
+			// the address may have been taken by a newer connection already
+			if (it != a.addresses.end() && it->second == id)
+				a.addresses.erase(it);
+		}
+
+		if (--_count == 0) {
+			// taking the lock before notifying means a waiter can't miss this between checking
+			// the count and going to sleep
+			std::lock_guard<std::mutex> empty_lock(_empty_lock);
+			_empty.notify_all();
+		}
+	}
+
+	/// <summary>
+	/// Wait until the registry is empty, i.e. until the last client is removed.
+	/// </summary>
+	///
+	/// <param name="timeout">
+	/// How long to wait for.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns true if the registry is empty, else false if the wait timed out.
+	/// </returns>
+	template <typename rep, typename period>
+	bool wait_empty(const std::chrono::duration<rep, period>& timeout) {
+		std::unique_lock<std::mutex> lock(_empty_lock);
+		return _empty.wait_for(lock, timeout, [this]() { return _count == 0; });
+	}
+
+	/// <summary>
+	/// Wait until the registry is empty, however long it takes.
+	/// </summary>
+	void wait_empty() {
+		std::unique_lock<std::mutex> lock(_empty_lock);
+		_empty.wait(lock, [this]() { return _count == 0; });
+	}
+
+	/// <summary>
+	/// Get the number of clients.
+	/// </summary>
+	size_t size() const {
+		return _count;
+	}
+
+	/// <summary>
+	/// Find a client's session by address.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns the session, or nullptr if there is no client with the given address.
+	/// </returns>
+	///
+	std::shared_ptr<session> find(const client_address& address, bool& found) {
+		found = false;
+		connection_id id = 0;
+
+		// it's essential to limit the scope of this mutex
+		{
+			shard& a = get_address_shard(address);
+			liblec::auto_mutex lock(a.lock);
+			auto it = a.addresses.find(address);
+
+			if (it == a.addresses.end())
+				return nullptr;
+
+			id = it->second;
+		}
+
+		shard& s = get_shard(id);
+		liblec::auto_mutex lock(s.lock);
+		auto it = s.clients.find(id);
+
+		if (it == s.clients.end())
+			return nullptr;
+
+		found = true;
+		return it->second.p_session.lock();
+	}
+
+	/// <summary>
+	/// Get the sessions of all the clients that are still alive.
+	/// </summary>
+	void sessions(std::vector<std::shared_ptr<session>>& sessions) {
+		sessions.clear();
+		sessions.reserve(size());
+
+		for (auto& p_shard : _shards) {
+			liblec::auto_mutex lock(p_shard->lock);
+
+			for (auto const& it : p_shard->clients) {
+				auto p_session = it.second.p_session.lock();
+
+				if (p_session)
+					sessions.push_back(p_session);
+			}
+		}
+	}
+
+	void get_client_info(std::vector<client_info>& clients_info) {
+		clients_info.clear();
+		clients_info.reserve(size());
+
+		for (auto& p_shard : _shards) {
+			liblec::auto_mutex lock(p_shard->lock);
+
+			for (auto const& it : p_shard->clients)
+				clients_info.push_back(it.second.get_client_info());
+		}
+	}
+
+	/// <summary>
+	/// Get the total traffic, i.e. that of the connected clients plus that of all the clients
+	/// that have disconnected.
+	/// </summary>
+	void traffic(liblec::lecnet::network_traffic& traffic) {
+		traffic = liblec::lecnet::network_traffic();
+
+		for (auto& p_shard : _shards) {
+			liblec::auto_mutex lock(p_shard->lock);
+			traffic.in += p_shard->traffic.in;
+			traffic.out += p_shard->traffic.out;
+
+			for (auto const& it : p_shard->clients) {
+				traffic.in += it.second.p_traffic->in.load(std::memory_order_relaxed);
+				traffic.out += it.second.p_traffic->out.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	struct entry {
+		client_address address;
+		std::weak_ptr<session> p_session;
+		const traffic_counters* p_traffic = nullptr;
+
+		client_info get_client_info() const {
+			client_info info;
+			info.address = address;
+			info.traffic.in = p_traffic->in.load(std::memory_order_relaxed);
+			info.traffic.out = p_traffic->out.load(std::memory_order_relaxed);
+			return info;
+		}
+	};
+
+	struct alignas(64) shard {
+		liblec::mutex lock;
+		std::unordered_map<connection_id, entry> clients;
+
+		// the connections whose address hashes to this shard, wherever they live
+		std::unordered_map<client_address, connection_id> addresses;
+
+		// the traffic of the clients in this shard that have disconnected
+		liblec::lecnet::network_traffic traffic;
+	};
+
+	shard& get_shard(connection_id id) {
+		return *_shards[id % _shards.size()];
+	}
+
+	shard& get_address_shard(const client_address& address) {
+		return *_shards[std::hash<client_address>()(address) % _shards.size()];
+	}
+
+	std::vector<std::unique_ptr<shard>> _shards;
+	std::atomic<size_t> _count{ 0 };
+	std::atomic<connection_id> _next_id{ 1 };
+
+	// signalled when the last client is removed
+	std::mutex _empty_lock;
+	std::condition_variable _empty;
+
+	client_registry(const client_registry&) = delete;
+	client_registry& operator=(const client_registry&) = delete;
+};
@@ -0,0 +1,111 @@
+//
+// memory_budget.cpp - server memory budget implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "memory_budget.h"
+
+memory_budget::memory_budget(size_t limit) :
+	_limit(limit) {}
+
+void memory_budget::set_limit(size_t limit) {
+	_limit = limit;
+	notify();
+}
+
+size_t memory_budget::limit() const {
+	return _limit;
+}
+
+bool memory_budget::fits(size_t bytes) const {
+	const size_t limit = _limit;
+	const size_t used = _used;
+	return limit == 0 || used == 0 || used + bytes <= limit;
+}
+
+bool memory_budget::try_acquire(size_t bytes) {
+	const size_t limit = _limit;
+	size_t used = _used.load(std::memory_order_relaxed);
+
+	do {
+		if (limit > 0 && used > 0 && used + bytes > limit)
+			return false;
+	} while (!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+
+	return true;
+}
+
+void memory_budget::acquire(size_t bytes) {
+	_used.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void memory_budget::release(size_t bytes) {
+	// both sequentially consistent, pairing with wait(): either the waiter sees the memory
+	// released here, or this sees the waiter
+	_used.fetch_sub(bytes, std::memory_order_seq_cst);
+
+	if (_waiting.load(std::memory_order_seq_cst))
+		notify();
+}
+
+bool memory_budget::exhausted() const {
+	return !fits(1);
+}
+
+void memory_budget::wait(size_t bytes,
+	std::function<void()> on_available) {
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		// flagged before checking again, so that a release() in between either notifies or
+		// is seen by the check; it takes the lock to notify, so it finds the waiter in place
+		_waiting.store(true, std::memory_order_seq_cst);
+
+		// memory may have been released since the caller found there wasn't enough
+		if (!fits(bytes)) {
+			_waiters.push_back(std::move(on_available));
+			return;
+		}
+
+		if (_waiters.empty())
+			_waiting.store(false, std::memory_order_seq_cst);
+	}
+
+	on_available();
+}
+
+void memory_budget::cancel_waits() {
+	std::vector<std::function<void()>> waiters;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		waiters.swap(_waiters);
+		_waiting = false;
+	}
+
+	// the handlers are destroyed outside the lock, as whatever they hold may well release
+	// memory when it goes
+	waiters.clear();
+}
+
+void memory_budget::notify() {
+	std::vector<std::function<void()>> waiters;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		waiters.swap(_waiters);
+		_waiting = false;
+	}
+
+	// call the handlers outside the lock, as they may well wait again
+	for (auto& it : waiters)
+		it();
+}
@@ -0,0 +1,85 @@
+//
+// memory_budget.h - server memory budget interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// A number of bytes shared by all the connections of a server, to bound how much memory they
+/// can make it hold at any one time. Thread safe.
+/// </summary>
+///
+/// <remarks>
+/// Memory that has to be allocated for data received is reserved with <see cref="try_acquire"/>
+/// and a connection that can't get it stops reading until some is released. Memory that the
+/// server can't refuse (e.g. for responses) is accounted for with <see cref="acquire"/>, which
+/// can take the budget over its limit.
+/// </remarks>
+class memory_budget {
+public:
+	/// <param name="limit">
+	/// The number of bytes in the budget, or 0 for no limit.
+	/// </param>
+	memory_budget(size_t limit = 0);
+
+	void set_limit(size_t limit);
+	size_t limit() const;
+
+	/// <summary>
+	/// Reserve memory if the budget has room for it. A budget with nothing reserved always has
+	/// room, so that a single request bigger than the whole budget doesn't wait forever.
+	/// </summary>
+	bool try_acquire(size_t bytes);
+
+	/// <summary>
+	/// Reserve memory whether the budget has room for it or not.
+	/// </summary>
+	void acquire(size_t bytes);
+
+	/// <summary>
+	/// Give back reserved memory, calling the handlers waiting for it.
+	/// </summary>
+	void release(size_t bytes);
+
+	/// <summary>
+	/// Check whether the budget is used up.
+	/// </summary>
+	bool exhausted() const;
+
+	/// <summary>
+	/// Call a handler the next time memory is released. The handler is called right away (on
+	/// this thread) if the budget already has room for the given number of bytes.
+	/// </summary>
+	void wait(size_t bytes,
+		std::function<void()> on_available);
+
+	/// <summary>
+	/// Drop the handlers waiting for memory without calling them.
+	/// </summary>
+	void cancel_waits();
+
+private:
+	bool fits(size_t bytes) const;
+	void notify();
+
+	std::atomic<size_t> _limit;
+	std::atomic<size_t> _used{ 0 };
+
+	std::mutex _lock;
+	std::vector<std::function<void()>> _waiters;
+	std::atomic<bool> _waiting{ false };
+
+	memory_budget(const memory_budget&) = delete;
+	memory_budget& operator=(const memory_budget&) = delete;
+};
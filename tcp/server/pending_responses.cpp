@@ -0,0 +1,97 @@
+//
+// pending_responses.cpp - server pending responses implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "pending_responses.h"
+
+#include <vector>
+
+pending_responses::send_handler pending_responses::add(unsigned long long connection_id,
+	send_handler on_send) {
+	unsigned long long ticket = 0;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		if (_cancelled || _dropped.count(connection_id))
+			return [](std::string) {};
+
+		ticket = ++_next_ticket;
+		_pending.emplace(ticket, std::make_pair(connection_id, std::move(on_send)));
+	}
+
+	auto p_this = shared_from_this();
+
+	return [p_this, ticket](std::string payload) {
+		p_this->send(ticket, std::move(payload));
+	};
+}
+
+void pending_responses::send(unsigned long long ticket,
+	std::string payload) {
+	std::shared_lock<std::shared_mutex> sending(_sending);
+	send_handler on_send;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		auto it = _pending.find(ticket);
+
+		if (it == _pending.end())
+			return;
+
+		on_send = std::move(it->second.second);
+		_pending.erase(it);
+	}
+
+	on_send(std::move(payload));
+}
+
+void pending_responses::drop(unsigned long long connection_id) {
+	std::vector<send_handler> dropped;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_dropped.insert(connection_id);
+
+		for (auto it = _pending.begin(); it != _pending.end();) {
+			if (it->second.first == connection_id) {
+				dropped.push_back(std::move(it->second.second));
+				it = _pending.erase(it);
+			}
+			else
+				it++;
+		}
+	}
+
+	// the handlers are destroyed outside the lock, as the session they hold may go with them
+	dropped.clear();
+}
+
+void pending_responses::forget(unsigned long long connection_id) {
+	std::lock_guard<std::mutex> lock(_lock);
+	_dropped.erase(connection_id);
+}
+
+void pending_responses::cancel() {
+	std::unordered_map<unsigned long long, std::pair<unsigned long long, send_handler>> pending;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::unique_lock<std::shared_mutex> sending(_sending);
+		std::lock_guard<std::mutex> lock(_lock);
+		pending.swap(_pending);
+		_cancelled = true;
+	}
+
+	// the handlers are destroyed outside the locks, as the sessions they hold go with them
+	pending.clear();
+}
@@ -0,0 +1,92 @@
+//
+// pending_responses.h - server pending responses interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+/// <summary>
+/// The responses a server's asynchronous handlers have yet to send. Thread safe.
+/// </summary>
+///
+/// <remarks>
+/// A response is sent by a handler that posts it to the client's session, which the handler
+/// keeps alive until then. A client that is closed on purpose would otherwise be kept until
+/// its handlers get round to answering, so its responses are let go of with
+/// <see cref="drop"/>. When the server stops, the sessions and the io services they post to are
+/// about to be deleted, so the handlers still pending are let go of with <see cref="cancel"/>,
+/// and responses sent from then on are discarded.
+/// </remarks>
+class pending_responses : public std::enable_shared_from_this<pending_responses> {
+public:
+	typedef std::function<void(std::string payload)> send_handler;
+
+	pending_responses() = default;
+
+	/// <summary>
+	/// Register a response.
+	/// </summary>
+	///
+	/// <param name="connection_id">
+	/// The ID of the connection the response is for.
+	/// </param>
+	///
+	/// <param name="on_send">
+	/// Sends the response to the connection.
+	/// </param>
+	///
+	/// <returns>
+	/// The function that sends the response, which can be called from any thread, and holds
+	/// on to the registry rather than the other way round.
+	/// </returns>
+	send_handler add(unsigned long long connection_id,
+		send_handler on_send);
+
+	/// <summary>
+	/// Let go of a connection's pending responses without sending them, and of any registered
+	/// for it from now on, until <see cref="forget"/> is called.
+	/// </summary>
+	void drop(unsigned long long connection_id);
+
+	/// <summary>
+	/// Forget about a connection that was dropped, once it's gone.
+	/// </summary>
+	void forget(unsigned long long connection_id);
+
+	/// <summary>
+	/// Let go of the responses still pending without sending them, waiting for those being
+	/// sent to be done.
+	/// </summary>
+	void cancel();
+
+private:
+	void send(unsigned long long ticket,
+		std::string payload);
+
+	// held shared while a response is being sent, and exclusively to cancel
+	std::shared_mutex _sending;
+
+	std::mutex _lock;
+	// by ticket, with the connection each response is for
+	std::unordered_map<unsigned long long, std::pair<unsigned long long, send_handler>> _pending;
+	std::unordered_set<unsigned long long> _dropped;
+	unsigned long long _next_ticket = 0;
+	bool _cancelled = false;
+
+	pending_responses(const pending_responses&) = delete;
+	pending_responses& operator=(const pending_responses&) = delete;
+};
@@ -19,9 +19,11 @@ std::string server_log::server_already_running() {
 	return "Server already running";
 }
 
-std::string server_log::start_info(std::string max_clients) {
+std::string server_log::start_info(std::string max_clients,
+	std::string io_threads) {
 	std::string s;
 	s += "Clients: Max " + max_clients;
+	s += ", I/O threads: " + io_threads;
 	return s;
 }
 
@@ -45,6 +47,30 @@ std::string server_log::close(std::string address) {
 	return address + " - closing connection ...";
 }
 
+std::string server_log::drain() {
+	return "Draining connections ...";
+}
+
+std::string server_log::drained() {
+	return "All connections drained";
+}
+
+std::string server_log::drain_timeout(std::string clients) {
+	return "Drain timed out, " + clients + " connection(s) still busy";
+}
+
+std::string server_log::handoff() {
+	return "Handing over to successor ...";
+}
+
+std::string server_log::handed_off(std::string clients) {
+	return "Handed over to successor with " + clients + " connection(s)";
+}
+
+std::string server_log::taken_over(std::string clients) {
+	return "Took over from predecessor with " + clients + " connection(s)";
+}
+
 std::string server_log::close_error(std::string address) {
 	return address + " - invalid address";
 }
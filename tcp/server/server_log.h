@@ -21,7 +21,8 @@ namespace server_log {
 
 	std::string server_already_running();
 
-	std::string start_info(std::string max_clients);
+	std::string start_info(std::string max_clients,
+		std::string io_threads);
 
 	std::string stop();
 
@@ -33,6 +34,18 @@ namespace server_log {
 
 	std::string close(std::string address);
 
+	std::string drain();
+
+	std::string drained();
+
+	std::string drain_timeout(std::string clients);
+
+	std::string handoff();
+
+	std::string handed_off(std::string clients);
+
+	std::string taken_over(std::string clients);
+
 	std::string close_error(std::string address);
 
 	std::string sending_failed(std::string address);
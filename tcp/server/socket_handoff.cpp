@@ -0,0 +1,412 @@
+//
+// socket_handoff.cpp - server socket handoff implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "socket_handoff.h"
+
+#include <algorithm>
+
+#if !defined(_WIN32)
+	#include <cerrno>
+	#include <cstring>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/types.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+
+	#if !defined(MSG_NOSIGNAL)
+		#define MSG_NOSIGNAL 0	// e.g. macOS, where SO_NOSIGPIPE would be needed instead
+	#endif
+#endif
+
+namespace {
+	// the most sockets attached to one message, well below what any system allows
+	const size_t max_sockets_per_message = 64;
+
+#if defined(_WIN32)
+	const char* not_supported = "Socket handoff is not supported on this platform";
+#else
+	std::string last_error() {
+		return std::strerror(errno);
+	}
+
+	bool make_address(const std::string& path,
+		sockaddr_un& address,
+		std::string& error) {
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+
+		if (path.empty() || path.length() >= sizeof(address.sun_path)) {
+			error = "Invalid handoff path: " + path;
+			return false;
+		}
+
+		std::memcpy(address.sun_path, path.c_str(), path.length());
+		return true;
+	}
+
+	void close_on_exec(socket_handoff::native_socket s) {
+		::fcntl(s, F_SETFD, ::fcntl(s, F_GETFD) | FD_CLOEXEC);
+	}
+
+	/// <summary>
+	/// Check whether the process at the other end of a channel runs as the same user as this
+	/// one, as the listening socket, and possibly clients' connections, go to it.
+	/// </summary>
+	bool same_user(socket_handoff::native_socket s) {
+	#if defined(SO_PEERCRED)
+		ucred credentials{};
+		socklen_t length = sizeof(credentials);
+
+		return ::getsockopt(s, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 &&
+			credentials.uid == ::geteuid();
+	#else
+		uid_t uid = 0;
+		gid_t gid = 0;
+		return ::getpeereid(s, &uid, &gid) == 0 && uid == ::geteuid();
+	#endif
+	}
+#endif
+}
+
+bool socket_handoff::connect(const std::string& path,
+	long timeout_seconds,
+	native_socket& channel,
+	std::string& error) {
+	channel = invalid_socket;
+
+#if defined(_WIN32)
+	error = not_supported;
+	return false;
+#else
+	sockaddr_un address;
+
+	if (!make_address(path, address, error))
+		return false;
+
+	const native_socket s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (s == invalid_socket) {
+		error = last_error();
+		return false;
+	}
+
+	close_on_exec(s);
+
+	if (::connect(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		error = last_error();
+		::close(s);
+		return false;
+	}
+
+	if (!same_user(s)) {
+		error = "The handoff predecessor runs as a different user";
+		::close(s);
+		return false;
+	}
+
+	// a predecessor that stops responding mustn't hold this server up forever
+	timeval timeout{};
+	timeout.tv_sec = timeout_seconds;
+	::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	channel = s;
+	return true;
+#endif
+}
+
+bool socket_handoff::send(native_socket channel,
+	message kind,
+	const std::vector<native_socket>& sockets,
+	std::string& error) {
+#if defined(_WIN32)
+	error = not_supported;
+	return false;
+#else
+	size_t sent = 0;
+
+	// a message with no sockets is still sent, as the kind is all there is to some messages
+	do {
+		const size_t count = std::min(sockets.size() - sent, max_sockets_per_message);
+
+		char byte = static_cast<char>(kind);
+		iovec iov{ &byte, 1 };
+
+		std::vector<char> control(CMSG_SPACE(sizeof(native_socket) * max_sockets_per_message));
+
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if (count > 0) {
+			msg.msg_control = control.data();
+			msg.msg_controllen = CMSG_SPACE(sizeof(native_socket) * count);
+
+			cmsghdr* p_cmsg = CMSG_FIRSTHDR(&msg);
+			p_cmsg->cmsg_level = SOL_SOCKET;
+			p_cmsg->cmsg_type = SCM_RIGHTS;
+			p_cmsg->cmsg_len = CMSG_LEN(sizeof(native_socket) * count);
+			std::memcpy(CMSG_DATA(p_cmsg), sockets.data() + sent,
+				sizeof(native_socket) * count);
+		}
+
+		ssize_t result;
+
+		do {
+			result = ::sendmsg(channel, &msg, MSG_NOSIGNAL);
+		} while (result < 0 && errno == EINTR);
+
+		if (result != 1) {
+			error = result < 0 ? last_error() : "Handoff message not sent";
+			return false;
+		}
+
+		sent += count;
+	} while (sent < sockets.size());
+
+	return true;
+#endif
+}
+
+bool socket_handoff::receive(native_socket channel,
+	message& kind,
+	std::vector<native_socket>& sockets,
+	std::string& error) {
+	sockets.clear();
+
+#if defined(_WIN32)
+	error = not_supported;
+	return false;
+#else
+	// a single byte at a time, so that the sockets attached to one message are never mixed up
+	// with those of the next
+	char byte = 0;
+	iovec iov{ &byte, 1 };
+
+	std::vector<char> control(CMSG_SPACE(sizeof(native_socket) * max_sockets_per_message));
+
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data();
+	msg.msg_controllen = control.size();
+
+	int flags = 0;
+#if defined(MSG_CMSG_CLOEXEC)
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	ssize_t result;
+
+	do {
+		result = ::recvmsg(channel, &msg, flags);
+	} while (result < 0 && errno == EINTR);
+
+	if (result <= 0) {
+		if (result < 0)
+			error = last_error();
+
+		return false;
+	}
+
+	for (cmsghdr* p_cmsg = CMSG_FIRSTHDR(&msg); p_cmsg; p_cmsg = CMSG_NXTHDR(&msg, p_cmsg)) {
+		if (p_cmsg->cmsg_level != SOL_SOCKET || p_cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		const size_t count = (p_cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(native_socket);
+		const size_t first = sockets.size();
+		sockets.resize(first + count);
+		std::memcpy(sockets.data() + first, CMSG_DATA(p_cmsg), sizeof(native_socket) * count);
+	}
+
+#if !defined(MSG_CMSG_CLOEXEC)
+	for (auto& it : sockets)
+		close_on_exec(it);
+#endif
+
+	if (msg.msg_flags & MSG_CTRUNC) {
+		for (auto& it : sockets)
+			::close(it);
+
+		sockets.clear();
+		error = "Handoff message truncated";
+		return false;
+	}
+
+	kind = static_cast<message>(byte);
+	return true;
+#endif
+}
+
+bool socket_handoff::is_ipv6(native_socket socket) {
+#if defined(_WIN32)
+	return false;
+#else
+	sockaddr_storage address{};
+	socklen_t length = sizeof(address);
+
+	if (::getsockname(socket, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+		return false;
+
+	return address.ss_family == AF_INET6;
+#endif
+}
+
+void socket_handoff::close(native_socket socket) {
+#if !defined(_WIN32)
+	if (socket != invalid_socket)
+		::close(socket);
+#endif
+}
+
+socket_handoff::listener::listener() {}
+
+socket_handoff::listener::~listener() {
+	stop();
+}
+
+bool socket_handoff::listener::start(const std::string& path,
+	successor_handler on_successor,
+	std::string& error) {
+	stop();
+
+#if defined(_WIN32)
+	error = not_supported;
+	return false;
+#else
+	sockaddr_un address;
+
+	if (!make_address(path, address, error))
+		return false;
+
+	const native_socket s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (s == invalid_socket) {
+		error = last_error();
+		return false;
+	}
+
+	close_on_exec(s);
+
+	// the path is left behind by a predecessor, or one that stopped without cleaning up, but
+	// anything other than a socket there isn't ours to remove
+	struct stat status {};
+
+	if (::lstat(path.c_str(), &status) == 0) {
+		if (!S_ISSOCK(status.st_mode)) {
+			error = "The handoff path is in use by something other than a socket: " + path;
+			::close(s);
+			return false;
+		}
+
+		::unlink(path.c_str());
+	}
+
+	if (::bind(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		error = last_error();
+		::close(s);
+		return false;
+	}
+
+	// only this user can connect; nothing can connect before listen(), so there's no window
+	if (::chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 || ::listen(s, 1) != 0) {
+		error = last_error();
+		::close(s);
+		::unlink(path.c_str());
+		return false;
+	}
+
+	if (::pipe(_wake) != 0) {
+		error = last_error();
+		::close(s);
+		::unlink(path.c_str());
+		return false;
+	}
+
+	close_on_exec(_wake[0]);
+	close_on_exec(_wake[1]);
+
+	_path = path;
+	_on_successor = on_successor;
+	_socket = s;
+	_handed_off = false;
+	_thread = std::thread(&listener::listen_func, this);
+	return true;
+#endif
+}
+
+void socket_handoff::listener::stop() {
+#if !defined(_WIN32)
+	if (!_thread.joinable())
+		return;
+
+	// wake the thread up if it's still listening
+	const char byte = 0;
+	while (::write(_wake[1], &byte, 1) < 0 && errno == EINTR);
+
+	_thread.join();
+
+	::close(_wake[0]);
+	::close(_wake[1]);
+	_wake[0] = _wake[1] = invalid_socket;
+
+	if (!_handed_off)
+		::unlink(_path.c_str());
+
+	_on_successor = nullptr;
+#endif
+}
+
+void socket_handoff::listener::listen_func() {
+#if !defined(_WIN32)
+	native_socket channel = invalid_socket;
+
+	while (true) {
+		pollfd fds[2] = { { _socket, POLLIN, 0 }, { _wake[0], POLLIN, 0 } };
+
+		if (::poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		// stopping
+		if (fds[1].revents)
+			break;
+
+		channel = ::accept(_socket, nullptr, nullptr);
+
+		if (channel == invalid_socket)
+			continue;
+
+		// anyone else is turned away, and the server keeps listening for its real successor
+		if (same_user(channel))
+			break;
+
+		::close(channel);
+		channel = invalid_socket;
+	}
+
+	// only one successor can take over
+	::close(_socket);
+	_socket = invalid_socket;
+
+	if (channel != invalid_socket) {
+		close_on_exec(channel);
+
+		// the path now belongs to the successor, which listens on it in turn
+		_handed_off = true;
+		_on_successor(channel);
+	}
+#endif
+}
@@ -0,0 +1,135 @@
+//
+// socket_handoff.h - server socket handoff interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Passing sockets from a server process to its successor over a Unix domain socket, so that
+/// the server can be restarted without its listening socket ever closing.
+/// </summary>
+///
+/// <remarks>
+/// The successor connects to the path its predecessor is listening on, and the predecessor
+/// sends it a message with its listening sockets followed by any number of messages with the
+/// sockets of clients it is handing over, then a message to say it is done. Each message is a
+/// single byte, its kind, with the sockets attached (SCM_RIGHTS). Only available where there
+/// are Unix domain sockets that can carry sockets; elsewhere every call fails.
+/// </remarks>
+namespace socket_handoff {
+	typedef int native_socket;
+	const native_socket invalid_socket = -1;
+
+	// how long a successor waits for each message from its predecessor
+	const long timeout_seconds = 10;
+
+	enum class message : char {
+		listeners = 'L',
+		clients = 'C',
+		done = 'D',
+	};
+
+	/// <summary>
+	/// Connect to a predecessor.
+	/// </summary>
+	///
+	/// <param name="path">
+	/// The path the predecessor is listening on.
+	/// </param>
+	///
+	/// <param name="timeout_seconds">
+	/// How long to wait for each message from the predecessor before giving up on it.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns true if successful, else false, e.g. if there is no predecessor.
+	/// </returns>
+	bool connect(const std::string& path,
+		long timeout_seconds,
+		native_socket& channel,
+		std::string& error);
+
+	/// <summary>
+	/// Send a message, with the given sockets attached. The sockets remain open in this process.
+	/// </summary>
+	bool send(native_socket channel,
+		message kind,
+		const std::vector<native_socket>& sockets,
+		std::string& error);
+
+	/// <summary>
+	/// Receive the next message.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns true if a message was received, else false if the channel was closed or
+	/// receiving failed, in which case the error is set if there was one.
+	/// </returns>
+	bool receive(native_socket channel,
+		message& kind,
+		std::vector<native_socket>& sockets,
+		std::string& error);
+
+	/// <summary>
+	/// Check whether a socket is an IPv6 one.
+	/// </summary>
+	bool is_ipv6(native_socket socket);
+
+	void close(native_socket socket);
+
+	/// <summary>
+	/// Listens for a successor on a thread of its own.
+	/// </summary>
+	class listener {
+	public:
+		typedef std::function<void(native_socket channel)> successor_handler;
+
+		listener();
+		~listener();
+
+		/// <summary>
+		/// Start listening. Whatever was at the path before is replaced.
+		/// </summary>
+		///
+		/// <param name="on_successor">
+		/// Called on the listener's thread when a successor connects, which is then the end
+		/// of listening. The handler is free to block, and owns the channel.
+		/// </param>
+		bool start(const std::string& path,
+			successor_handler on_successor,
+			std::string& error);
+
+		/// <summary>
+		/// Stop listening, waiting for the successor handler to return if it's running. The
+		/// path is removed unless a successor took over, as it is then the successor's.
+		/// </summary>
+		void stop();
+
+	private:
+		void listen_func();
+
+		std::string _path;
+		successor_handler _on_successor;
+		native_socket _socket = invalid_socket;
+
+		// written to wake the listener's thread up when stopping
+		native_socket _wake[2] = { invalid_socket, invalid_socket };
+
+		bool _handed_off = false;
+		std::thread _thread;
+
+		listener(const listener&) = delete;
+		listener& operator=(const listener&) = delete;
+	};
+}
@@ -15,9 +15,26 @@
 #include "../../tcp.h"
 #include "../../helper_fxns/helper_fxns.h"
 #include "../../auto_mutex/auto_mutex.h"
+#include "../frame/frame_decoder.h"
+#include "../frame/write_queue.h"
+#include "../frame/buffer_pool.h"
+#include "../frame/frame_compression.h"
 #include "server_log.h"
+#include "client_registry.h"
+#include "worker_pool.h"
+#include "timer_wheel.h"
+#include "memory_budget.h"
+#include "pending_responses.h"
+#include "token_bucket.h"
+#include "socket_handoff.h"
 
 #include <future>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#include <mutex>
 
 #define _CRT_SECURE_NO_WARNINGS
 #define ASIO_STANDALONE
@@ -28,10 +45,12 @@
 
 #if defined(_WINSOCKAPI_)
 	#undef _WINSOCKAPI_
+	#include <boost/bind.hpp>
 	#include <boost/asio.hpp>
 	#include <boost/thread.hpp>
 	#define _WINSOCKAPI_
 #else
+	#include <boost/bind.hpp>
 	#include <boost/asio.hpp>
 	#include <boost/thread.hpp>
 #endif
@@ -45,24 +64,143 @@ public:
 	void log(const std::string& event);
 
 	static void server_func(liblec::lecnet::tcp::server_async* p_current);
+	static void io_thread_func(liblec::lecnet::tcp::server_async* p_current,
+		size_t shard);
+	void stop_io();
+	void client_removed();
+	void stop_accepting();
+	void take_over(std::vector<socket_handoff::native_socket>& listeners,
+		std::vector<socket_handoff::native_socket>& clients);
+	void adopt(const std::vector<socket_handoff::native_socket>& clients);
+	void hand_off(socket_handoff::native_socket channel);
+
+	// a frame being pushed, framed once as it is and once for each way it could be
+	// compressed: by codec, with the frame as it is at index 0, then with each dictionary,
+	// in the order of _compression_dictionaries
+	struct push_frames {
+		std::array<std::shared_ptr<const std::string>, 3> by_codec;
+		std::vector<std::shared_ptr<const std::string>> by_dictionary;
+	};
+
+	push_frames make_push(const std::string& data);
+	std::shared_ptr<const std::string> make_shared_frame(const std::string& payload,
+		unsigned long flags);
 
 	std::string _host_address;
 	unsigned short _port;
 	unsigned short _max_clients;
-	network_traffic _total_traffic;
+	unsigned short _io_threads = 1;
+	bool _sharded = false;
+	unsigned short _worker_threads = 0;
+	size_t _worker_queue_capacity = 0;
+	unsigned long _max_frames_in_flight = 1;
+	bool _asynchronous_handlers = false;
+	size_t _max_write_queue_bytes = 0;
+	std::chrono::seconds _idle_timeout{ 0 };
+	std::chrono::seconds _read_header_timeout{ 0 };
+	std::chrono::seconds _write_timeout{ 0 };
+	size_t _max_frame_size = 0;
+	size_t _max_client_memory = 0;
+	std::vector<liblec::lecnet::tcp::compression> _compression_codecs;
+	size_t _compression_threshold = 0;
+	frame_compression::dictionaries _compression_dictionaries;
+	memory_budget _memory;
+	worker_pool _workers;
+	std::shared_ptr<pending_responses> _p_pending_responses;
+	token_bucket _accept_rate;
+
+	bool timeouts_enabled() const {
+		return _idle_timeout.count() > 0 || _read_header_timeout.count() > 0 ||
+			_write_timeout.count() > 0;
+	}
 
-	struct client_info_internal {
-		liblec::lecnet::tcp::server::client_info client_info;
-		void* p_socket_internal = nullptr;
-	};
+	bool budgets_enabled() const {
+		return _max_client_memory > 0 || _memory.limit() > 0;
+	}
+
+	client_registry<_session_async> _clients;
+
+	// the acceptors, to resume when a client disconnects from a full server
+	std::vector<_server_async*> _acceptors;
+	liblec::mutex _acceptors_lock;
+
+	// set while the server is being drained, for sessions and acceptors to wind down
+	std::atomic<bool> _draining{ false };
 
-	std::map<client_address, client_info_internal> _clients;
+	// for handing the server over to a successor process
+	std::string _handoff_path;
+	bool _handoff_clients = false;
+	socket_handoff::listener _handoff;
 
 	std::future<void> _fut;
-	boost::asio::io_service* _p_io_service = nullptr;
+
+	/// <summary>
+	/// An io_service, the I/O threads that run it and the read buffers and timeouts its
+	/// sessions share. There is a single shard unless the server is sharded, in which case each
+	/// I/O thread gets a shard of its own.
+	/// </summary>
+	struct alignas(64) io_shard {
+		/// <param name="threads">
+		/// The number of I/O threads that run the io_service.
+		/// </param>
+		explicit io_shard(unsigned short threads) :
+			threads(threads) {
+			for (unsigned short i = 0; i < threads; i++)
+				wheels.push_back(std::make_unique<timer_wheel>());
+		}
+
+		// declared before the io_service so that they outlive the sessions they serve
+		buffer_pool buffers;
+
+		// a timer wheel per I/O thread, so that the threads of an unsharded server don't all
+		// contend for the lock of a single wheel; each session keeps to the wheel it was given
+		std::vector<std::unique_ptr<timer_wheel>> wheels;
+		std::atomic<size_t> next_wheel{ 0 };
+
+		boost::asio::io_service io_service;
+
+		// keeps the I/O threads running while the sessions have nothing pending on the
+		// io_service, e.g. while they wait for workers after accepting has stopped
+		boost::asio::io_service::work work{ io_service };
+
+		std::vector<std::unique_ptr<boost::asio::steady_timer>> ticks;
+		const unsigned short threads;
+
+		/// <summary>
+		/// Get the timer wheel for a new session. The sessions are dealt out to the wheels in
+		/// turn.
+		/// </summary>
+		timer_wheel& timers() {
+			return *wheels[next_wheel.fetch_add(1, std::memory_order_relaxed) % wheels.size()];
+		}
+
+		/// <summary>
+		/// Drive the timer wheels from the io_service, a tick at a time.
+		/// </summary>
+		void tick() {
+			for (size_t i = 0; i < wheels.size(); i++) {
+				ticks.push_back(std::make_unique<boost::asio::steady_timer>(io_service));
+				tick(*ticks.back(), *wheels[i]);
+			}
+		}
+
+	private:
+		void tick(boost::asio::steady_timer& timer, timer_wheel& wheel) {
+			timer.expires_after(wheel.tick());
+			timer.async_wait([this, &timer, &wheel](const boost::system::error_code& ec) {
+				if (ec)
+					return;
+
+				wheel.advance(timer_wheel::clock::now());
+				tick(timer, wheel);
+			});
+		}
+	};
+
+	std::vector<std::unique_ptr<io_shard>> _shards;
+	liblec::mutex _shards_lock;
 
 	// critical section lockers
-	static liblec::mutex _clients_lock;
 	static liblec::mutex log_locker;
 
 	friend class _session_async;
@@ -76,6 +214,13 @@ public:
 	unsigned long _magic_number = 0;
 };
 
+void liblec::lecnet::tcp::server_async::impl::stop_io() {
+	liblec::auto_mutex lock(_shards_lock);
+
+	for (auto& p_shard : _shards)
+		p_shard->io_service.stop();
+}
+
 void liblec::lecnet::tcp::server_async::impl::log(const std::string& event) {
 	liblec::auto_mutex lock(log_locker);
 	_p_tcp_server->log(time_stamp(), event);
@@ -86,226 +231,1208 @@ unsigned short liblec::lecnet::tcp::server_async::impl::get_max_clients() {
 }
 
 size_t liblec::lecnet::tcp::server_async::impl::get_number_of_clients() {
-	liblec::auto_mutex lock(_clients_lock);
 	return _clients.size();
 }
 
+/// <summary>
+/// Frame data to be pushed to clients, once however many clients it goes to.
+/// </summary>
+liblec::lecnet::tcp::server_async::impl::push_frames
+liblec::lecnet::tcp::server_async::impl::make_push(const std::string& data) {
+	push_frames frames;
+	frames.by_codec[0] = make_shared_frame(data, 0);
+
+	// compressed here, on the thread pushing the data, rather than by each session
+	if (data.length() >= _compression_threshold) {
+		for (auto const& codec : _compression_codecs) {
+			std::string compressed;
+
+			if (frame_compression::compress(codec, nullptr, data, compressed))
+				frames.by_codec[static_cast<size_t>(codec)] = make_shared_frame(compressed,
+					frame_decoder::compressed_flag);
+		}
+
+		// only zstd takes a dictionary
+		if (std::find(_compression_codecs.begin(), _compression_codecs.end(),
+			frame_compression::codec::zstd) != _compression_codecs.end())
+			for (auto const& it : _compression_dictionaries) {
+				std::string compressed;
+
+				frames.by_dictionary.push_back(frame_compression::compress(
+					frame_compression::codec::zstd, it.get(), data, compressed) ?
+					make_shared_frame(compressed, frame_decoder::compressed_flag) : nullptr);
+			}
+	}
+
+	return frames;
+}
+
+std::shared_ptr<const std::string>
+liblec::lecnet::tcp::server_async::impl::make_shared_frame(const std::string& payload,
+	unsigned long flags) {
+	// clients never send message 0 themselves, which is how they tell a push from a response
+	const frame_header header(_magic_number, 0, payload.length(), flags);
+
+	std::string frame;
+	frame.reserve(frame_header::size + payload.length());
+	frame.append(header.data, frame_header::size);
+	frame.append(payload);
+
+	if (!budgets_enabled())
+		return std::make_shared<const std::string>(std::move(frame));
+
+	// the frame counts against the server's memory once, for as long as any client holds it
+	const size_t length = frame.length();
+	_memory.acquire(length);
+
+	return std::shared_ptr<const std::string>(new std::string(std::move(frame)),
+		[this, length](const std::string* p_frame) {
+		delete p_frame;
+		_memory.release(length);
+	});
+}
+
+/// <summary>
+/// The sockets of the connections being handed over to a successor. Each session that is
+/// asked to hand its connection over either adds its socket or declines, once it has finished
+/// with the frames it already received.
+/// </summary>
+class handoff_collection {
+public:
+	handoff_collection(size_t sessions) :
+		_pending(sessions) {}
+
+	/// <summary>
+	/// Take a socket out of its session and add it to the collection.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns true if successful, else false if the socket has to stay with the session, e.g.
+	/// because it's too late and the collection has already been taken.
+	/// </returns>
+	bool add(boost::asio::ip::tcp::socket& socket) {
+		std::lock_guard<std::mutex> lock(_lock);
+		_pending--;
+		_done.notify_all();
+
+		if (_taken)
+			return false;
+
+		// the pending operations on the socket are cancelled
+		boost::system::error_code ec;
+		const auto native_socket = socket.release(ec);
+
+		if (ec)
+			return false;
+
+		_sockets.push_back(static_cast<socket_handoff::native_socket>(native_socket));
+		return true;
+	}
+
+	void decline() {
+		std::lock_guard<std::mutex> lock(_lock);
+		_pending--;
+		_done.notify_all();
+	}
+
+	/// <summary>
+	/// Wait for the sessions, up to the given time, then take the sockets collected.
+	/// </summary>
+	std::vector<socket_handoff::native_socket> take(const std::chrono::seconds& timeout) {
+		std::unique_lock<std::mutex> lock(_lock);
+		_done.wait_for(lock, timeout, [this]() { return _pending == 0; });
+		_taken = true;
+		return std::move(_sockets);
+	}
+
+private:
+	std::mutex _lock;
+	std::condition_variable _done;
+	size_t _pending;
+	bool _taken = false;
+	std::vector<socket_handoff::native_socket> _sockets;
+};
+
 class liblec::lecnet::tcp::server_async::_session_async :
 	public std::enable_shared_from_this<_session_async> {
 public:
-	_session_async(boost::asio::ip::tcp::socket socket, liblec::lecnet::tcp::server_async* p_this)
+	_session_async(boost::asio::ip::tcp::socket socket,
+		const boost::asio::ip::tcp::endpoint& remote_endpoint,
+		liblec::lecnet::tcp::server_async::impl::io_shard& shard,
+		liblec::lecnet::tcp::server_async* p_this)
 		: _socket(std::move(socket)),
-		_denied(false),
+		_strand(shard.io_service),
+		_buffers(shard.buffers),
+		_timers(shard.timers()),
+		_decoder(p_this->_d._magic_number, p_this->_d._max_frame_size),
+		_budgeted(p_this->_d.budgets_enabled()),
 		_p_this(p_this) {
-
-		liblec::auto_mutex lock(impl::_clients_lock);
-
-		impl::client_info_internal this_client;
-		this_client.client_info.address = _socket.remote_endpoint().address().to_string() + ":" +
-			std::to_string(_socket.remote_endpoint().port());
-		_address = this_client.client_info.address;
-		this_client.client_info.traffic.in = 0;
-		this_client.client_info.traffic.out = 0;
-		this_client.p_socket_internal = (void*)& _socket;
-
-		// add this client to the clients map
-		_p_this->_d._clients[this_client.client_info.address] = this_client;
+		_connection.address = remote_endpoint.address().to_string() + ":" +
+			std::to_string(remote_endpoint.port());
 	}
 
 	~_session_async() {
-		// remove this client to the clients map
-		liblec::auto_mutex lock(impl::_clients_lock);
-		_p_this->_d._clients.erase(_address);
+		// a handoff shouldn't wait for a session that never got round to it
+		if (_p_handoff)
+			_p_handoff->decline();
+
+		// give back whatever memory this client still had
+		if (_memory_used > 0)
+			_p_this->_d._memory.release(_memory_used);
+
+		// remove this client from the clients registry, making room for another
+		_p_this->_d._clients.remove(_connection.id);
+		_p_this->_d._p_pending_responses->forget(_connection.id);
+		_p_this->_d.client_removed();
 
 		// client has disconnected
-		if (!_denied)
-			_p_this->_d.log(server_log::client_disconnected(std::string(_address), _last_error));
+		_p_this->_d.log(server_log::client_disconnected(std::string(_connection.address),
+			_last_error));
 	}
 
-	void start(bool deny) {
-		_denied = deny;
+	void start() {
+		// reads are only made once data has arrived, and must never block the I/O thread
+		boost::system::error_code ec;
+		_socket.non_blocking(true, ec);
+
+		// responses are already put together before they're written, so waiting for more
+		// data to fill a segment only holds up the last one
+		_socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+		// payloads are only allocated once they fit within the memory budgets
+		if (_budgeted)
+			_decoder.set_reserve_handler([this](size_t bytes) { return reserve(bytes); });
+
+		// add this client to the clients registry
+		_connection.id = _p_this->_d._clients.add(_connection.address, shared_from_this(),
+			&_traffic);
+
+		_p_this->_d.log(server_log::client_connected(std::string(_connection.address)));
 
-		if (deny) {
-			_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-			//_p_this->log(std::string(_address) + " - connection declined");
+		// the server started draining after it accepted this client
+		if (_p_this->_d._draining) {
+			close();
+			return;
 		}
-		else {
-			liblec::auto_mutex lock(impl::_clients_lock);
-			_p_this->_d.log(server_log::client_connected(std::string(_address)));
+
+		if (_p_this->_d.timeouts_enabled()) {
+			// the timer only holds a weak reference so that it doesn't keep the session alive
+			std::weak_ptr<_session_async> weak_self = shared_from_this();
+			_p_timer = std::make_shared<timer_wheel::timer>();
+			_p_timer->on_expire = [weak_self]() {
+				if (auto self = weak_self.lock())
+					self->_strand.post([self]() { self->check_timeouts(); });
+			};
+
+			_last_activity = timer_wheel::clock::now();
+			update_timeout();
 		}
 
 		do_read();
 	}
 
+	void close() {
+		auto self(shared_from_this());
+
+		// the socket is only ever touched from within this session's strand
+		_strand.post([this, self]() {
+			boost::system::error_code ec;
+			_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+			_socket.close(ec);
+
+			// responses the handlers still owe this client would keep the session alive
+			if (_connection.id != 0)
+				_p_this->_d._p_pending_responses->drop(_connection.id);
+		});
+	}
+
+	/// <summary>
+	/// Stop reading from the client, and close the connection once the frames already
+	/// received have been handled and the responses sent.
+	/// </summary>
+	void drain() {
+		auto self(shared_from_this());
+
+		_strand.post([this, self]() {
+			_draining = true;
+			close_if_drained();
+		});
+	}
+
+	/// <summary>
+	/// Drain the connection then, rather than closing it, hand it over to a successor
+	/// process. A connection that ends up part way through a frame is closed regardless.
+	/// </summary>
+	void hand_off(std::shared_ptr<handoff_collection> p_collection) {
+		auto self(shared_from_this());
+
+		_strand.post([this, self, p_collection]() {
+			if (_closed) {
+				p_collection->decline();
+				return;
+			}
+
+			_p_handoff = p_collection;
+			_draining = true;
+			close_if_drained();
+		});
+	}
+
+	/// <summary>
+	/// Queue a frame that was framed beforehand, e.g. one that is being broadcast. It is sent
+	/// compressed if it was compressed with the codec agreed on with the client.
+	/// </summary>
+	void push(const impl::push_frames& frames) {
+		auto self(shared_from_this());
+
+		_strand.post([this, self, frames]() {
+			if (_closed)
+				return;
+
+			// a client that isn't keeping up is disconnected rather than left to miss pushes
+			if (_p_this->_d._max_write_queue_bytes > 0 &&
+				_write_queue.bytes() >= _p_this->_d._max_write_queue_bytes) {
+				_last_error = "Write queue full";
+				_closed = true;
+				boost::system::error_code ec;
+				_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+				_socket.close(ec);
+				return;
+			}
+
+			outgoing_frame frame;
+			frame.p_shared = frames.by_codec[0];
+
+			if (_p_dictionary) {
+				auto const& dictionaries = _p_this->_d._compression_dictionaries;
+				const size_t index = std::find(dictionaries.begin(), dictionaries.end(),
+					_p_dictionary) - dictionaries.begin();
+
+				if (index < frames.by_dictionary.size() && frames.by_dictionary[index])
+					frame.p_shared = frames.by_dictionary[index];
+			}
+			else
+				if (frames.by_codec[static_cast<size_t>(_codec)])
+					frame.p_shared = frames.by_codec[static_cast<size_t>(_codec)];
+
+			queue(std::move(frame));
+		});
+	}
+
 private:
+	void close_if_drained() {
+		if (!_draining || _closed || _in_flight > 0 || _writing || !_write_queue.empty())
+			return;
+
+		if (_p_handoff) {
+			auto p_collection = std::move(_p_handoff);
+
+			// the pending read is cancelled, and the connection carries on in the successor;
+			// not if a codec was agreed on, though, as the successor wouldn't know which
+			if (!_decoder.partial() && _codec == frame_compression::codec::none &&
+				p_collection->add(_socket)) {
+				_closed = true;
+				_last_error = "Handed over";
+				update_timeout();
+				return;
+			}
+
+			p_collection->decline();
+		}
+
+		// the pending read completes with an error and releases the session
+		if (_last_error.empty())
+			_last_error = "Drained";
+
+		_closed = true;
+		boost::system::error_code ec;
+		_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+		_socket.close(ec);
+	}
+
 	void do_read() {
+		// decode what was held back if the memory it was waiting for has been released
+		if (_decoder.blocked() && !_closed &&
+			!_decoder.resume([this](frame_decoder::frame& f) { process_received_data(f); },
+				_last_error)) {
+			decode_failed();
+			return;
+		}
+
+		if (_reading || _closed || _draining || !_parked.empty() || _write_backlogged ||
+			_in_flight >= _p_this->_d._max_frames_in_flight || waiting_for_memory())
+			return;
+
+		_reading = true;
 		auto self(shared_from_this());
 
-		_socket.async_read_some(boost::asio::buffer(_buffer, buffer_size),
-			[this, self](boost::system::error_code ec, std::size_t length) {
-				if (!ec) {
-					_received += std::string(_buffer, length);
-
-					// append data received to client traffic
-					append_traffic_in(length);
-
-					// retrieve magic number
-					if (get_ul_prefix(_received, 1) == _p_this->_d._magic_number) {
-						// retrieve embedded length
-						unsigned long length = get_ul_prefix(_received, 3);
-
-						if (length == _received.length()) {
-							// all data has been received
-
-							// retrieve message ID
-							unsigned long message_id = get_ul_prefix(_received, 2);
-
-							process_received_data(_received, message_id);
-							_received.clear();
-						}
-						else {
-							if (length > _received.length())
-								do_write(false);	// essential to stay connected
-							else {
-								_last_error = "Invalid data received";
-								do_write(false);	// essential to stay connected
-							}
-						}
-					}
-					else {
-						_last_error = "Invalid data received";
-						do_write(false);	// essential to stay connected
+		// read large payloads straight into place rather than through a read buffer
+		char* p_payload = nullptr;
+		size_t payload_size = 0;
+
+		if (_decoder.payload_buffer(p_payload, payload_size) &&
+			payload_size >= buffer_pool::max_size) {
+			_socket.async_read_some(boost::asio::buffer(p_payload, payload_size),
+				_strand.wrap([this, self](boost::system::error_code ec, std::size_t length) {
+					_reading = false;
+
+					// the rest of a frame that arrives while draining is never handled
+					if (!ec && _draining)
+						return;
+
+					if (!ec) {
+						// append data received to client traffic
+						append_traffic_in(length);
+
+						_decoder.commit(length, [this](frame_decoder::frame& f) {
+							process_received_data(f);
+						});
+
+						data_received();
+
+						// keep reading while earlier frames are still being handled
+						do_read();
 					}
+					else
+						read_failed(ec);
+				})
+			);
+
+			return;
+		}
+
+		// wait for data to arrive before taking a read buffer, so that an idle client doesn't
+		// hold one
+		_socket.async_wait(boost::asio::ip::tcp::socket::wait_read,
+			_strand.wrap([this, self](boost::system::error_code ec) {
+				_reading = false;
+
+				if (ec) {
+					read_failed(ec);
+					return;
 				}
-				else
-					_last_error = ec.message();
-			}
+
+				// frames that arrive while draining are left unread
+				if (_draining)
+					return;
+
+				// take a buffer big enough for what has arrived, and only for as long as it
+				// takes to decode it
+				boost::system::error_code available_ec;
+				const size_t available = _socket.available(available_ec);
+				buffer_pool::buffer buffer = _buffers.get(std::max(available, size_t(1)));
+
+				const size_t length = _socket.read_some(boost::asio::buffer(buffer.data(),
+					buffer.size()), ec);
+
+				if (ec == boost::asio::error::would_block) {
+					do_read();
+					return;
+				}
+
+				if (ec) {
+					read_failed(ec);
+					return;
+				}
+
+				// append data received to client traffic
+				append_traffic_in(length);
+
+				if (!_decoder.feed(buffer.data(), length, [this](frame_decoder::frame& f) {
+					process_received_data(f);
+				}, _last_error)) {
+					decode_failed();
+					return;
+				}
+
+				buffer.release();
+				data_received();
+
+				// keep reading while earlier frames are still being handled
+				do_read();
+			})
 		);
 	}
 
-	void do_write(bool write_all) {
+	void decode_failed() {
+		// the stream can't be made sense of any more
+		_closed = true;
+		boost::system::error_code ec;
+		_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+		_socket.close(ec);
+	}
+
+	/// <summary>
+	/// Reserve memory for a payload from this client's budget and the server's.
+	/// </summary>
+	bool reserve(size_t bytes) {
+		const size_t limit = _p_this->_d._max_client_memory;
+		_server_memory_wanted = 0;
+
+		if (limit > 0 && _memory_used > 0 && _memory_used + bytes > limit)
+			return false;
+
+		if (!_p_this->_d._memory.try_acquire(bytes)) {
+			_server_memory_wanted = bytes;
+			return false;
+		}
+
+		_memory_used += bytes;
+		return true;
+	}
+
+	/// <summary>
+	/// Account for memory that has to be used whether the budgets allow it or not.
+	/// </summary>
+	void charge(size_t bytes) {
+		if (!_budgeted || bytes == 0)
+			return;
+
+		_memory_used += bytes;
+		_p_this->_d._memory.acquire(bytes);
+	}
+
+	void discharge(size_t bytes) {
+		if (!_budgeted || bytes == 0)
+			return;
+
+		_memory_used -= bytes;
+		_p_this->_d._memory.release(bytes);
+	}
+
+	/// <summary>
+	/// Check whether reading has to wait for memory to be released. This client's own memory
+	/// is released from within this session, which then reads again anyway; if it's the
+	/// server's memory that's needed, arrange to be told when some is released.
+	/// </summary>
+	bool waiting_for_memory() {
+		if (!_budgeted)
+			return false;
+
+		size_t server_bytes = 0;
+
+		if (_decoder.blocked())
+			server_bytes = _server_memory_wanted;
+		else {
+			// the rest of a frame goes into the memory already reserved for it
+			if (_decoder.partial())
+				return false;
+
+			const size_t limit = _p_this->_d._max_client_memory;
+
+			if (limit == 0 || _memory_used < limit) {
+				if (!_p_this->_d._memory.exhausted())
+					return false;
+
+				server_bytes = 1;
+			}
+		}
+
+		if (server_bytes > 0 && !_memory_wait) {
+			_memory_wait = true;
+
+			// with no reads or writes pending, it's the wait that keeps this session alive
+			auto self(shared_from_this());
+			_p_this->_d._memory.wait(server_bytes, [self]() {
+				self->_strand.post([self]() {
+					self->_memory_wait = false;
+					self->do_read();
+				});
+			});
+		}
+
+		return true;
+	}
+
+	void read_failed(const boost::system::error_code& ec) {
+		// keep the reason the socket was closed, if it was closed on purpose
+		if (_last_error.empty())
+			_last_error = ec.message();
+
+		_closed = true;
+	}
+
+	void data_received() {
+		if (!_p_timer)
+			return;
+
+		const auto now = timer_wheel::clock::now();
+		_last_activity = now;
+
+		// time the frame header from its first byte
+		if (!_decoder.header_partial())
+			_header_pending = false;
+		else
+			if (!_header_pending) {
+				_header_pending = true;
+				_header_started = now;
+			}
+
+		update_timeout();
+	}
+
+	/// <summary>
+	/// Arm the session's timer for the earliest of the timeouts that currently apply.
+	/// </summary>
+	void update_timeout() {
+		if (!_p_timer)
+			return;
+
+		if (_closed) {
+			_timers.cancel(_p_timer);
+			return;
+		}
+
+		auto deadline = timer_wheel::clock::time_point::max();
+
+		// idle means nothing is being handled or sent
+		if (_p_this->_d._idle_timeout.count() > 0 && _in_flight == 0 && !_writing)
+			deadline = std::min(deadline, _last_activity + _p_this->_d._idle_timeout);
+
+		if (_p_this->_d._read_header_timeout.count() > 0 && _header_pending)
+			deadline = std::min(deadline, _header_started + _p_this->_d._read_header_timeout);
+
+		if (_p_this->_d._write_timeout.count() > 0 && _writing)
+			deadline = std::min(deadline, _write_started + _p_this->_d._write_timeout);
+
+		if (deadline == timer_wheel::clock::time_point::max())
+			_timers.cancel(_p_timer);
+		else
+			_timers.arm(_p_timer, deadline);
+	}
+
+	void check_timeouts() {
+		if (_closed)
+			return;
+
+		const auto now = timer_wheel::clock::now();
+
+		if (_p_this->_d._write_timeout.count() > 0 && _writing &&
+			now >= _write_started + _p_this->_d._write_timeout)
+			_last_error = "Write timeout";
+		else
+			if (_p_this->_d._read_header_timeout.count() > 0 && _header_pending &&
+				now >= _header_started + _p_this->_d._read_header_timeout)
+				_last_error = "Read timeout";
+			else
+				if (_p_this->_d._idle_timeout.count() > 0 && _in_flight == 0 && !_writing &&
+					now >= _last_activity + _p_this->_d._idle_timeout)
+					_last_error = "Idle timeout";
+				else {
+					// woken early, e.g. the deadline was pushed back since the timer was armed
+					update_timeout();
+					return;
+				}
+
+		// the pending reads and writes complete with an error and release the session
+		_closed = true;
+		boost::system::error_code ec;
+		_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+		_socket.close(ec);
+	}
+
+	void do_write() {
+		if (_writing || _write_queue.empty())
+			return;
+
+		_writing = true;
+		_write_started = timer_wheel::clock::now();
+		update_timeout();
+
 		auto self(shared_from_this());
 
-		std::size_t length = 0;
+		// send as many of the queued frames as fit in one batch with a single gather write
+		std::vector<write_queue::segment> segments;
+		_write_queue.prepare(segments);
 
-		if (write_all)
-			length = _data_to_send.length();
+		std::vector<boost::asio::const_buffer> buffers;
+		buffers.reserve(segments.size());
 
-		_socket.async_write_some(
-			boost::asio::buffer(_data_to_send.c_str(), length),
-			[this, self](boost::system::error_code ec, std::size_t /*length*/) {
-				if (!ec)
+		for (auto const& it : segments)
+			buffers.push_back(boost::asio::buffer(it.data, it.size));
+
+		boost::asio::async_write(_socket, buffers,
+			_strand.wrap([this, self](boost::system::error_code ec, std::size_t /*length*/) {
+				_writing = false;
+
+				const size_t queued = _write_queue.owned_bytes();
+				_write_queue.consume();
+
+				if (!ec) {
+					discharge(queued - _write_queue.owned_bytes());
+					_last_activity = timer_wheel::clock::now();
+					do_write();
+					update_timeout();
+
+					// resume reading if it was held up by a backlog of responses
+					if (_write_backlogged &&
+						_write_queue.bytes() < _p_this->_d._max_write_queue_bytes / 2)
+						_write_backlogged = false;
+
+					// or by the memory the responses were taking up
 					do_read();
-				else
-					_last_error = ec.message();
-			}
+					close_if_drained();
+				}
+				else {
+					if (_last_error.empty())
+						_last_error = ec.message();
+
+					_closed = true;
+					_write_queue.clear();
+					discharge(queued);
+					update_timeout();
+				}
+			})
 		);
 	}
 
 	void append_traffic_in(size_t iLen) {
 		// append data received to client traffic
-		liblec::auto_mutex lock(impl::_clients_lock);
-		_p_this->_d._clients[_address].client_info.traffic.in += iLen;
-		_p_this->_d._total_traffic.in += iLen;
+		_traffic.append_in(iLen);
 	}
 
 	void append_traffic_out(size_t iLen) {
-		// append data received to client traffic
-		liblec::auto_mutex lock(impl::_clients_lock);
-		_p_this->_d._clients[_address].client_info.traffic.out += iLen;
-		_p_this->_d._total_traffic.out += iLen;
+		// append data sent to client traffic
+		_traffic.append_out(iLen);
 	}
 
-	void process_received_data(std::string& data, unsigned long id) {
-		// skip magic number
-		get_ul_prefix(data);
+	void process_received_data(frame_decoder::frame& f) {
+		// the rest of the data after a frame that couldn't be handled
+		if (_closed)
+			return;
+
+		if (f.control) {
+			negotiate(f.payload);
+			return;
+		}
+
+		const unsigned long id = f.message_id;
+		const auto codec = _codec;
+		const bool compressed = f.compressed;
 
-		// skip message id
-		get_ul_prefix(data);
+		// a payload in a string of its own had its memory reserved by the decoder
+		size_t charged = _budgeted && f.p_owned ? f.payload.length() : 0;
 
-		// skip embedded length
-		get_ul_prefix(data);
+		if (compressed) {
+			size_t length = 0;
+
+			if (codec == frame_compression::codec::none ||
+				!frame_compression::original_length(f.payload, length)) {
+				_last_error = "Invalid data received";
+				decode_failed();
+				return;
+			}
+
+			// the same limit applies to a frame however it was sent
+			if (_p_this->_d._max_frame_size > 0 &&
+				frame_header::size + length > _p_this->_d._max_frame_size) {
+				_last_error = "Frame too large";
+				decode_failed();
+				return;
+			}
+
+			// the payload will be decompressed whether the budgets allow it or not
+			charge(length);
+			charged += _budgeted ? length : 0;
+		}
+
+		_in_flight++;
 
 		/*
 		** call the virtual function on_receive(), passing in this client's address and the data
 		** received the function will return data to be sent back to the client, if the server so
 		** desires
 		*/
-		_data_to_send = _p_this->on_receive(_address, data);
+		if (_p_this->_d._worker_threads > 0) {
+			// call on_receive() on a worker thread then send the response from this strand
+			auto self(shared_from_this());
 
-		if (!_data_to_send.empty()) {
-			unsigned long length = static_cast<unsigned long>
-				(_data_to_send.length() * sizeof(char))	// space for the actual message
-				+ sizeof(unsigned long)					// space for data length
-				+ sizeof(unsigned long)					// space for message ID
-				+ sizeof(unsigned long);				// space magic number
+			// if frames may be handled concurrently spread them across the workers, otherwise
+			// keep all of this client's frames on the same worker
+			unsigned long long key = _connection.id;
 
-			// prefix data with it's length
-			prefix_with_ul(length, _data_to_send);
+			if (_p_this->_d._max_frames_in_flight > 1)
+				key += _frames_dispatched++;
 
-			// prefix with message ID
-			prefix_with_ul(id, _data_to_send);
+			// the payload is copied out of the read buffer to go to the worker
+			if (_budgeted && !f.p_owned) {
+				charge(f.payload.length());
+				charged += f.payload.length();
+			}
 
-			// prefix with magic number
-			prefix_with_ul(_p_this->_d._magic_number, _data_to_send);
+			worker_pool::task t = [this, self, data = f.take(), id, charged, codec,
+				p_dictionary = _p_dictionary, compressed]() mutable {
+				std::string response;
+				bool response_compressed = false;
+				std::string error;
+				bool handled = true;
+
+				try {
+					if (_p_this->_d._asynchronous_handlers) {
+						// the response is sent from this strand whenever it's ready
+						if (handle_async(std::move(data), id, charged, codec, p_dictionary,
+							compressed, error))
+							return;
+
+						handled = false;
+					}
+					else
+						handled = handle(data, codec, p_dictionary.get(), compressed, response,
+							response_compressed, error);
+				}
+				catch (std::exception& e) {
+					_p_this->_d.log(e.what());
+				}
+
+				_strand.post([this, self, response = std::move(response), id, charged,
+					response_compressed, handled, error]() mutable {
+					if (!handled) {
+						_last_error = error;
+						decode_failed();
+					}
 
-			// send data to client
-			do_write(true);
+					send_response(std::move(response), id, charged, response_compressed);
+				});
+			};
 
-			// append data sent to client traffic
-			append_traffic_out(length);
+			// frames that come in while others are parked wait their turn behind them
+			_parked.emplace_back(key, std::move(t));
+
+			if (_parked.size() == 1)
+				post_parked();
+		}
+		else if (_p_this->_d._asynchronous_handlers) {
+			// the payload is copied out of the read buffer to outlive the handler
+			if (_budgeted && !f.p_owned) {
+				charge(f.payload.length());
+				charged += f.payload.length();
+			}
+
+			std::string error;
+
+			if (!handle_async(f.take(), id, charged, codec, _p_dictionary, compressed, error)) {
+				_last_error = error;
+				decode_failed();
+				send_response(std::string(), id, charged, false);
+			}
+		}
+		else {
+			// handle the data where it is, in the read buffer if it arrived in one piece
+			std::string response;
+			bool response_compressed = false;
+			std::string error;
+
+			if (!handle(f.payload, codec, _p_dictionary.get(), compressed, response,
+				response_compressed, error)) {
+				_last_error = error;
+				decode_failed();
+			}
+
+			send_response(std::move(response), id, charged, response_compressed);
 		}
-		else
-			do_write(false);	// essential to stay connected
 	}
 
-	boost::asio::ip::tcp::socket _socket;
+	/// <summary>
+	/// Decompress a frame's payload if need be, pass it to on_receive(), then compress the
+	/// response if it's worth it. Runs on a worker if there are any, so it only touches what
+	/// doesn't change once the session has started.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns false if the payload couldn't be decompressed.
+	/// </returns>
+	bool handle(std::string_view payload,
+		frame_compression::codec codec,
+		const frame_compression::dictionary* p_dictionary,
+		bool compressed,
+		std::string& response,
+		bool& response_compressed,
+		std::string& error) {
+		std::string decompressed;
+
+		if (compressed) {
+			if (!frame_compression::decompress(codec, p_dictionary, payload, decompressed,
+				error))
+				return false;
+
+			payload = decompressed;
+		}
+
+		liblec::lecnet::tcp::server::response_writer writer(response);
+		_p_this->on_receive(_connection, payload, writer);
+
+		response_compressed = compress_response(codec, p_dictionary, response);
+		return true;
+	}
+
+	/// <summary>
+	/// Decompress a frame's payload if need be and pass it to on_receive_async(), along with
+	/// a pending response that is sent from this strand once it's ready. Runs on a worker if
+	/// there are any.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns false if the payload couldn't be decompressed, in which case there is no
+	/// response to wait for.
+	/// </returns>
+	bool handle_async(std::string data,
+		unsigned long id,
+		size_t charged,
+		frame_compression::codec codec,
+		frame_compression::dictionary_ptr p_dictionary,
+		bool compressed,
+		std::string& error) {
+		if (compressed) {
+			std::string decompressed;
+
+			if (!frame_compression::decompress(codec, p_dictionary.get(), data, decompressed,
+				error))
+				return false;
+
+			data.swap(decompressed);
+		}
+
+		// the session is kept alive until the response is sent, or the client is closed
+		auto self(shared_from_this());
+
+		auto on_send = _p_this->_d._p_pending_responses->add(_connection.id,
+			[this, self, id, charged, codec, p_dictionary](std::string response) {
+			const bool response_compressed = compress_response(codec, p_dictionary.get(),
+				response);
+
+			_strand.post([this, self, response = std::move(response), id, charged,
+				response_compressed]() mutable {
+				send_response(std::move(response), id, charged, response_compressed);
+			});
+		});
+
+		try {
+			_p_this->on_receive_async(_connection, std::move(data),
+				liblec::lecnet::tcp::server::pending_response(std::move(on_send)));
+		}
+		catch (std::exception& e) {
+			// the response was sent empty as it went, unless the handler kept it
+			_p_this->_d.log(e.what());
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Compress a response if it's worth it.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns true if the response was compressed.
+	/// </returns>
+	bool compress_response(frame_compression::codec codec,
+		const frame_compression::dictionary* p_dictionary,
+		std::string& response) {
+		if (codec == frame_compression::codec::none ||
+			response.length() < _p_this->_d._compression_threshold)
+			return false;
+
+		std::string compressed_response;
+
+		if (!frame_compression::compress(codec, p_dictionary, response, compressed_response))
+			return false;
+
+		response.swap(compressed_response);
+		return true;
+	}
+
+	/// <summary>
+	/// Hand the parked frames to the workers, for as long as there is room in their queues.
+	/// Reading is held up while any frames are left parked, so a client whose worker is busy
+	/// can't get more than what it has already sent queued up.
+	/// </summary>
+	void post_parked() {
+		auto self(shared_from_this());
+
+		while (!_parked.empty()) {
+			if (!_p_this->_d._workers.post(_parked.front().first, _parked.front().second,
+				[this, self]() {
+				if (_p_this->_d._workers.running())
+					_strand.post([this, self]() {
+						post_parked();
+						do_read();
+					});
+				else
+					_parked.clear();	// the server is stopping, and the I/O threads are gone
+			}))
+				return;
+
+			_parked.pop_front();
+		}
+	}
+
+	/// <summary>
+	/// Agree on a codec, and a dictionary if any, with the client, out of those it offered.
+	/// </summary>
+	void negotiate(std::string_view offer) {
+		_codec = frame_compression::choose(offer, _p_this->_d._compression_codecs,
+			_p_this->_d._compression_dictionaries, _p_dictionary);
+
+		outgoing_frame frame;
+		frame.payload = frame_compression::answer(_codec, _p_dictionary);
+		frame.header = frame_header(_p_this->_d._magic_number, 0, frame.payload.length(),
+			frame_decoder::control_flag);
+		queue(std::move(frame));
+	}
+
+	void send_response(std::string response,
+		unsigned long id,
+		size_t charged,
+		bool compressed) {
+		_in_flight--;
+
+		// the frame is done with
+		discharge(charged);
+
+		if (!frame_header::fits(response.length())) {
+			_p_this->_d.log(std::string(_connection.address) +
+				" - response too large to send");
+			response.clear();
+		}
+
+		if (!response.empty() && !_closed) {
+			outgoing_frame frame;
+			frame.header = frame_header(_p_this->_d._magic_number, id, response.length(),
+				compressed ? frame_decoder::compressed_flag : 0);
+			frame.payload = std::move(response);
+
+			// responses are sent in the order they are ready, which is not necessarily the
+			// order the frames were received in
+			queue(std::move(frame));
+		}
+
+		// with nothing left to handle or send the client starts being idle from now
+		if (_p_timer && _in_flight == 0 && !_writing) {
+			_last_activity = timer_wheel::clock::now();
+			update_timeout();
+		}
+
+		// resume reading if it was held up by this frame
+		do_read();
+		close_if_drained();
+	}
+
+	/// <summary>
+	/// Queue a frame for sending to the client.
+	/// </summary>
+	void queue(outgoing_frame&& frame) {
+		const size_t length = frame.length();
 
-	enum { buffer_size = 1024 * 64 };
-	char _buffer[buffer_size];
+		const size_t queued = _write_queue.owned_bytes();
+		_write_queue.push(std::move(frame));
+		charge(_write_queue.owned_bytes() - queued);
+		do_write();
+
+		// stop reading from a client that isn't keeping up with its responses
+		if (_p_this->_d._max_write_queue_bytes > 0 &&
+			_write_queue.bytes() >= _p_this->_d._max_write_queue_bytes)
+			_write_backlogged = true;
+
+		// append data sent to client traffic
+		append_traffic_out(length);
+	}
+
+	boost::asio::ip::tcp::socket _socket;
+	boost::asio::io_service::strand _strand;
+	buffer_pool& _buffers;
+	timer_wheel& _timers;
+	std::shared_ptr<timer_wheel::timer> _p_timer;
+	timer_wheel::clock::time_point _last_activity;
+	timer_wheel::clock::time_point _header_started;
+	timer_wheel::clock::time_point _write_started;
+	bool _header_pending = false;
+
+	liblec::lecnet::tcp::server_async::connection _connection;
+	traffic_counters _traffic;
+	frame_decoder _decoder;
+	write_queue _write_queue;
+	frame_compression::codec _codec = frame_compression::codec::none;
+	frame_compression::dictionary_ptr _p_dictionary;
+	bool _reading = false;
+	bool _writing = false;
+	bool _closed = false;
+	bool _draining = false;
+	std::shared_ptr<handoff_collection> _p_handoff;
+	bool _write_backlogged = false;
+	unsigned long _in_flight = 0;
+	unsigned long long _frames_dispatched = 0;
+
+	// frames waiting for room in a worker's queue, with the key of the queue
+	std::deque<std::pair<unsigned long long, worker_pool::task>> _parked;
+
+	// memory taken up by this client's frames and responses
+	const bool _budgeted;
+	size_t _memory_used = 0;
+	size_t _server_memory_wanted = 0;
+	bool _memory_wait = false;
 
-	liblec::lecnet::tcp::server_async::client_address _address;
-	std::string _received;
-	std::string _data_to_send;
-	bool _denied;
 	std::string _last_error;
 	liblec::lecnet::tcp::server_async* _p_this;
 };
 
 class liblec::lecnet::tcp::server_async::_server_async {
 public:
+	/// <param name="shard">
+	/// The shard whose io_service runs this acceptor. Accepted connections are handed to the
+	/// same shard, unless all_shards is true in which case they are dealt out to all the
+	/// shards in turn.
+	/// </param>
 	_server_async(boost::asio::ip::address ip,
-		short port,
+		unsigned short port,
+		size_t shard,
+		bool all_shards,
 		liblec::lecnet::tcp::server_async* p_this) :
-		_acceptor(*p_this->_d._p_io_service,
-			boost::asio::ip::tcp::endpoint(ip, port)),
-		_socket(*p_this->_d._p_io_service),
+		_acceptor(p_this->_d._shards[shard]->io_service),
+		_accept_timer(p_this->_d._shards[shard]->io_service),
+		_shard(shard),
+		_next_shard(shard),
+		_all_shards(all_shards),
 		_p_this(p_this) {
+		boost::asio::ip::tcp::endpoint endpoint(ip, port);
+		_acceptor.open(endpoint.protocol());
+		_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+
+#if defined(SO_REUSEPORT)
+		if (!all_shards && p_this->_d._shards.size() > 1) {
+			// let the kernel spread incoming connections across the shards' acceptors
+			typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>
+				reuse_port;
+			_acceptor.set_option(reuse_port(true));
+		}
+#endif
 
-		do_accept();
+		_acceptor.bind(endpoint);
+		_acceptor.listen();
 
-		p_this->_d.log(server_log::start(_acceptor.local_endpoint().address().to_string(),
-			_acceptor.local_endpoint().port(),
-			"Async"));
-		p_this->_d.log(server_log::start_info(std::to_string(p_this->_d.get_max_clients())));
+		start();
+	}
+
+	/// <summary>
+	/// Accept connections on a listening socket taken over from a predecessor.
+	/// </summary>
+	_server_async(socket_handoff::native_socket listener,
+		size_t shard,
+		bool all_shards,
+		liblec::lecnet::tcp::server_async* p_this) :
+		_acceptor(p_this->_d._shards[shard]->io_service),
+		_accept_timer(p_this->_d._shards[shard]->io_service),
+		_shard(shard),
+		_next_shard(shard),
+		_all_shards(all_shards),
+		_p_this(p_this) {
+		_acceptor.assign(socket_handoff::is_ipv6(listener) ?
+			boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(), listener);
 
-		liblec::auto_mutex lock(_p_this->_d._starting_lock);
-		_p_this->_d._starting = false;
+		start();
+	}
+
+	~_server_async() {
+		liblec::auto_mutex lock(_p_this->_d._acceptors_lock);
+		auto& acceptors = _p_this->_d._acceptors;
+		acceptors.erase(std::remove(acceptors.begin(), acceptors.end(), this), acceptors.end());
+	}
+
+	boost::asio::ip::tcp::endpoint local_endpoint() {
+		return _acceptor.local_endpoint();
+	}
+
+	socket_handoff::native_socket native_handle() {
+		return static_cast<socket_handoff::native_socket>(_acceptor.native_handle());
+	}
+
+	/// <summary>
+	/// Start accepting again if accepting was paused because the server was full.
+	/// </summary>
+	void resume() {
+		if (_paused.exchange(false))
+			_p_this->_d._shards[_shard]->io_service.post([this]() { do_accept(); });
+	}
+
+	/// <summary>
+	/// Stop listening, so that new connections are refused rather than left in the backlog.
+	/// </summary>
+	void stop() {
+		_p_this->_d._shards[_shard]->io_service.post([this]() {
+			boost::system::error_code ec;
+			_acceptor.close(ec);
+			_accept_timer.cancel();
+		});
 	}
 
 private:
+	void start() {
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(_p_this->_d._acceptors_lock);
+			_p_this->_d._acceptors.push_back(this);
+		}
+
+		do_accept();
+	}
+
+	/// <summary>
+	/// Check whether the server is full, in which case accepting is paused until a client
+	/// disconnects, and new connections are left waiting in the backlog meanwhile.
+	/// </summary>
+	bool paused_at_capacity() {
+		if (_p_this->_d.get_number_of_clients() < _p_this->_d.get_max_clients())
+			return false;
+
+		_paused = true;
+
+		// a client may have disconnected before accepting was paused, with nothing to resume it
+		if (_p_this->_d.get_number_of_clients() < _p_this->_d.get_max_clients() &&
+			_paused.exchange(false))
+			return false;
+
+		return true;
+	}
+
 	void do_accept() {
-		_acceptor.async_accept(_socket,
-			[this](boost::system::error_code ec) {
-				if (!ec) {
-					bool deny = false;
+		if (_p_this->_d._draining || paused_at_capacity())
+			return;
 
-					{ // failsafe
-						if (_p_this->_d.get_number_of_clients() >= _p_this->_d.get_max_clients())
-							deny = true;
-					}
+		// hold back if connections are coming in faster than they should be accepted
+		const auto wait = _p_this->_d._accept_rate.take();
+
+		if (wait != token_bucket::clock::duration::zero()) {
+			_accept_timer.expires_after(wait);
+			_accept_timer.async_wait([this](const boost::system::error_code& ec) {
+				if (!ec)
+					do_accept();
+			});
+
+			return;
+		}
+
+		size_t shard = _shard;
+
+		if (_all_shards) {
+			shard = _next_shard;
+			_next_shard = (_next_shard + 1) % _p_this->_d._shards.size();
+		}
+
+		auto& io_shard = *_p_this->_d._shards[shard];
 
-					std::make_shared<_session_async>(std::move(_socket), _p_this)->start(deny);
+		_acceptor.async_accept(io_shard.io_service,
+			[this, &io_shard](boost::system::error_code ec,
+				boost::asio::ip::tcp::socket socket) {
+				if (!ec) {
+					// the client may have gone already, in which case the socket just closes
+					boost::system::error_code endpoint_ec;
+					const auto remote_endpoint = socket.remote_endpoint(endpoint_ec);
+
+					// failsafe: the acceptors of other shards may have filled the server since
+					// it was last checked
+					if (!endpoint_ec &&
+						_p_this->_d.get_number_of_clients() < _p_this->_d.get_max_clients())
+						std::make_shared<_session_async>(std::move(socket), remote_endpoint,
+							io_shard, _p_this)->start();
 				}
 
 				do_accept();
@@ -313,13 +1440,164 @@ private:
 	}
 
 	boost::asio::ip::tcp::acceptor _acceptor;
-	boost::asio::ip::tcp::socket _socket;
+	boost::asio::steady_timer _accept_timer;
+	std::atomic<bool> _paused{ false };
+	size_t _shard;
+	size_t _next_shard;
+	bool _all_shards;
 	liblec::lecnet::tcp::server_async* _p_this;
 };
 
+void liblec::lecnet::tcp::server_async::impl::client_removed() {
+	liblec::auto_mutex lock(_acceptors_lock);
+
+	for (auto& p_acceptor : _acceptors)
+		p_acceptor->resume();
+}
+
+void liblec::lecnet::tcp::server_async::impl::stop_accepting() {
+	liblec::auto_mutex lock(_acceptors_lock);
+
+	for (auto& p_acceptor : _acceptors)
+		p_acceptor->stop();
+}
+
+void liblec::lecnet::tcp::server_async::impl::take_over(
+	std::vector<socket_handoff::native_socket>& listeners,
+	std::vector<socket_handoff::native_socket>& clients) {
+	socket_handoff::native_socket channel;
+	std::string error;
+
+	// there is no predecessor
+	if (_handoff_path.empty() ||
+		!socket_handoff::connect(_handoff_path, socket_handoff::timeout_seconds, channel, error))
+		return;
+
+	socket_handoff::message kind;
+	std::vector<socket_handoff::native_socket> sockets;
+
+	// whatever was received before the predecessor went quiet is kept
+	while (socket_handoff::receive(channel, kind, sockets, error)) {
+		if (kind == socket_handoff::message::listeners)
+			listeners.insert(listeners.end(), sockets.begin(), sockets.end());
+		else
+			if (kind == socket_handoff::message::clients)
+				clients.insert(clients.end(), sockets.begin(), sockets.end());
+			else {
+				for (auto& it : sockets)
+					socket_handoff::close(it);
+
+				if (kind == socket_handoff::message::done)
+					break;
+			}
+	}
+
+	socket_handoff::close(channel);
+
+	if (!error.empty())
+		log(error);
+
+	if (!listeners.empty())
+		log(server_log::taken_over(std::to_string(clients.size())));
+}
+
+void liblec::lecnet::tcp::server_async::impl::adopt(
+	const std::vector<socket_handoff::native_socket>& clients) {
+	for (size_t i = 0; i < clients.size(); i++) {
+		auto& io_shard = *_shards[i % _shards.size()];
+
+		boost::system::error_code ec;
+		boost::asio::ip::tcp::socket socket(io_shard.io_service);
+		socket.assign(socket_handoff::is_ipv6(clients[i]) ?
+			boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(), clients[i], ec);
+
+		if (ec) {
+			socket_handoff::close(clients[i]);
+			continue;
+		}
+
+		const auto remote_endpoint = socket.remote_endpoint(ec);
+
+		if (!ec && get_number_of_clients() < get_max_clients())
+			std::make_shared<_session_async>(std::move(socket), remote_endpoint, io_shard,
+				_p_tcp_server)->start();
+	}
+}
+
+void liblec::lecnet::tcp::server_async::impl::hand_off(socket_handoff::native_socket channel) {
+	log(server_log::handoff());
+
+	std::string error;
+	bool sent = false;
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_acceptors_lock);
+
+		std::vector<socket_handoff::native_socket> listeners;
+
+		for (auto& p_acceptor : _acceptors)
+			listeners.push_back(p_acceptor->native_handle());
+
+		sent = socket_handoff::send(channel, socket_handoff::message::listeners, listeners,
+			error);
+	}
+
+	if (!sent) {
+		// carry on as if the successor never came
+		socket_handoff::close(channel);
+		log(error);
+		return;
+	}
+
+	// the successor accepts the new connections from here on
+	_draining = true;
+	stop_accepting();
+
+	std::shared_ptr<handoff_collection> p_collection;
+
+	// the io services mustn't be deleted while the sessions are being told
+	{
+		liblec::auto_mutex lock(_shards_lock);
+
+		std::vector<std::shared_ptr<_session_async>> sessions;
+		_clients.sessions(sessions);
+
+		p_collection = std::make_shared<handoff_collection>(sessions.size());
+
+		for (auto& p_session : sessions) {
+			if (_handoff_clients)
+				p_session->hand_off(p_collection);
+			else
+				p_session->drain();
+		}
+	}
+
+	// connections that are still busy once the successor is about to give up waiting stay
+	// here and are drained
+	std::vector<socket_handoff::native_socket> clients = p_collection->take(
+		std::chrono::seconds(_handoff_clients ? socket_handoff::timeout_seconds / 2 : 0));
+
+	if ((!clients.empty() &&
+		!socket_handoff::send(channel, socket_handoff::message::clients, clients, error)) ||
+		!socket_handoff::send(channel, socket_handoff::message::done, {}, error))
+		log(error);
+
+	// the successor has sockets of its own for these clients now
+	for (auto& it : clients)
+		socket_handoff::close(it);
+
+	socket_handoff::close(channel);
+	log(server_log::handed_off(std::to_string(clients.size())));
+
+	// stop once the clients that were left have been drained
+	_clients.wait_empty();
+	stop_io();
+	log(server_log::stop());
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 liblec::mutex liblec::lecnet::tcp::server_async::impl::log_locker;
-liblec::mutex liblec::lecnet::tcp::server_async::impl::_clients_lock;
 
 liblec::lecnet::tcp::server_async::server_async() :
 	_d(*(new impl)) {
@@ -343,19 +1621,131 @@ void liblec::lecnet::tcp::server_async::impl::server_func(
 		boost::asio::ip::address ip = boost::asio::ip::address::from_string(
 			p_current->_d._host_address);
 
-		_server_async s(ip, p_current->_d._port, p_current);
-		p_current->_d._p_io_service->run();
+		std::vector<std::unique_ptr<_server_async>> acceptors;
+		unsigned short port = p_current->_d._port;
+
+#if defined(SO_REUSEPORT)
+		const bool acceptor_per_shard = true;
+#else
+		// no SO_REUSEPORT; a single acceptor deals connections out to the shards
+		const bool acceptor_per_shard = false;
+#endif
+
+		// take over from a predecessor if there is one
+		std::vector<socket_handoff::native_socket> listeners, clients;
+		p_current->_d.take_over(listeners, clients);
+
+		const size_t shards = p_current->_d._shards.size();
+
+		// the predecessor's listening sockets are dealt out to the shards
+		for (size_t i = 0; i < listeners.size(); i++)
+			acceptors.push_back(std::make_unique<_server_async>(listeners[i], i % shards,
+				listeners.size() < shards, p_current));
+
+		for (size_t shard = 0; shard < shards && listeners.empty(); shard++) {
+			if (shard > 0 && !acceptor_per_shard)
+				break;
+
+			acceptors.push_back(std::make_unique<_server_async>(ip, port, shard,
+				!acceptor_per_shard, p_current));
+
+			// in case the port was 0, bind the rest of the shards to the port just picked
+			port = acceptors.back()->local_endpoint().port();
+		}
+
+		p_current->_d.log(server_log::start(
+			acceptors.front()->local_endpoint().address().to_string(),
+			acceptors.front()->local_endpoint().port(),
+			p_current->_d._sharded ? "Async, sharded" : "Async"));
+		p_current->_d.log(server_log::start_info(
+			std::to_string(p_current->_d.get_max_clients()),
+			std::to_string(p_current->_d._io_threads)));
+
+		p_current->_d.adopt(clients);
+
+		if (!p_current->_d._handoff_path.empty()) {
+			std::string error;
+
+			if (!p_current->_d._handoff.start(p_current->_d._handoff_path,
+				[p_current](socket_handoff::native_socket channel) {
+					p_current->_d.hand_off(channel);
+				}, error))
+				p_current->_d.log(error);
+		}
+
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(p_current->_d._starting_lock);
+			p_current->_d._starting = false;
+		}
+
+		if (p_current->_d._worker_threads > 0)
+			p_current->_d._workers.start(p_current->_d._worker_threads,
+				p_current->_d._worker_queue_capacity);
+
+		// run each shard's io_service on its I/O threads, this thread being one of them
+		boost::thread_group io_threads;
+
+		try {
+			for (size_t shard = 0; shard < p_current->_d._shards.size(); shard++) {
+				for (unsigned short i = 0; i < p_current->_d._shards[shard]->threads; i++) {
+					if (shard == 0 && i == 0)
+						continue;	// this thread
+
+					io_threads.create_thread(boost::bind(&impl::io_thread_func,
+						p_current, shard));
+				}
+			}
+		}
+		catch (std::exception& e) {
+			p_current->_d.log(e.what());
+		}
+
+		io_thread_func(p_current, 0);
+		io_threads.join_all();
 	}
 	catch (std::exception& e) {
 		p_current->_d.log(e.what());
 	}
 
-	liblec::auto_mutex lock(p_current->_d._starting_lock);
-	p_current->_d._starting = false;
+	// stop the workers before the io services their responses are posted to are deleted
+	p_current->_d._workers.stop();
+
+	// the pending responses hold sessions, and would post to the io services
+	p_current->_d._p_pending_responses->cancel();
+
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(p_current->_d._starting_lock);
+		p_current->_d._starting = false;
+	}
+
+	// the sessions deleted with the io services release their memory; nothing must be posted
+	// to the io services by then
+	p_current->_d._memory.cancel_waits();
 
-	// delete io service
-	delete p_current->_d._p_io_service;
-	p_current->_d._p_io_service = nullptr;
+	// it's essential to limit the scope of this mutex
+	{
+		// delete the io services
+		liblec::auto_mutex lock(p_current->_d._shards_lock);
+		p_current->_d._shards.clear();
+	}
+
+	// a handoff in progress finishes once its clients are gone with the io services
+	p_current->_d._handoff.stop();
+}
+
+void liblec::lecnet::tcp::server_async::impl::io_thread_func(
+	server_async* p_current, size_t shard) {
+	try {
+		p_current->_d._shards[shard]->io_service.run();
+	}
+	catch (std::exception& e) {
+		p_current->_d.log(e.what());
+
+		// an I/O thread is lost; stop the server rather than run degraded
+		p_current->_d.stop_io();
+	}
 }
 
 bool liblec::lecnet::tcp::server_async::start(const server_params& params) {
@@ -369,20 +1759,72 @@ bool liblec::lecnet::tcp::server_async::start(const server_params& params) {
 	_d._host_address = params.ip;
 	_d._port = params.port;
 	_d._max_clients = params.max_clients;
+	_d._accept_rate.set_rate(params.max_accept_rate,
+		params.accept_burst > 0 ? params.accept_burst : params.max_accept_rate);
+	_d._handoff_path = params.handoff_path;
+	_d._handoff_clients = params.handoff_clients;
 	_d._magic_number = params.magic_number;
+	_d._io_threads = params.io_threads;
+	_d._sharded = params.sharded;
+	_d._worker_threads = params.worker_threads;
+	_d._worker_queue_capacity = std::max(params.worker_queue_capacity, 1UL);
+	_d._max_frames_in_flight = std::max(params.max_frames_in_flight, 1UL);
+	_d._asynchronous_handlers = params.asynchronous_handlers;
+	_d._p_pending_responses = std::make_shared<pending_responses>();
+	_d._max_write_queue_bytes = params.max_write_queue_bytes;
+	_d._idle_timeout = std::chrono::seconds(params.idle_timeout_seconds);
+	_d._read_header_timeout = std::chrono::seconds(params.read_header_timeout_seconds);
+	_d._write_timeout = std::chrono::seconds(params.write_timeout_seconds);
+	_d._max_frame_size = params.max_frame_size;
+	_d._max_client_memory = params.max_client_memory;
+	_d._compression_codecs = params.compression_codecs;
+	_d._compression_threshold = params.compression_threshold;
+	_d._compression_dictionaries =
+		frame_compression::prepare(params.compression_dictionaries);
+	_d._memory.set_limit(static_cast<size_t>(params.max_server_memory));
+
+	if (_d._io_threads == 0) {
+		// one I/O thread per processor core
+		_d._io_threads = static_cast<unsigned short>(
+			std::max(1U, boost::thread::hardware_concurrency()));
+	}
 
 	try {
-		// Create io service.
-		_d._p_io_service = new boost::asio::io_service;
+		// create the io services; one per I/O thread if sharded, else one for all of them
+		{
+			liblec::auto_mutex lock(_d._shards_lock);
+			_d._shards.clear();
+
+			const unsigned short shards = _d._sharded ? _d._io_threads : 1;
+
+			for (unsigned short i = 0; i < shards; i++) {
+				_d._shards.push_back(std::make_unique<impl::io_shard>(
+					_d._sharded ? 1 : _d._io_threads));
+
+				// the shard's timer wheels check the timeouts of its sessions
+				if (_d.timeouts_enabled())
+					_d._shards.back()->tick();
+			}
+		}
+
+		// a registry shard per I/O thread
+		_d._clients.reset(_d._io_threads);
+		_d._draining = false;
+
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(_d._starting_lock);
+			_d._starting = true;
+		}
 
 		// run server task asynchronously
 		_d._fut = std::async(std::launch::async
 			, _d.server_func, this);
-
-		liblec::auto_mutex lock(_d._starting_lock);
-		_d._starting = true;
 	}
 	catch (std::exception& e) {
+		liblec::auto_mutex lock(_d._starting_lock);
+		_d._starting = false;
+
 		_d.log(e.what());
 		return false;
 	}
@@ -403,21 +1845,70 @@ bool liblec::lecnet::tcp::server_async::running() {
 }
 
 void liblec::lecnet::tcp::server_async::close(const client_address& address) {
-	liblec::auto_mutex lock(_d._clients_lock);
+	std::shared_ptr<_session_async> p_session;
 
 	try {
-		if (!(_d._clients.find(address) == _d._clients.end())) {
+		bool found = false;
+		p_session = _d._clients.find(address, found);
+
+		if (found)
 			_d.log(server_log::close(std::string(address)));
-			boost::asio::ip::tcp::socket* p_socket =
-				(boost::asio::ip::tcp::socket*)(_d._clients[address].p_socket_internal);
-			p_socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-			p_socket->close();
-		}
 		else
 			_d.log(server_log::close_error(std::string(address)));
+
+		if (p_session)
+			p_session->close();
+	}
+	catch (std::exception& e) {
+		_d.log(e.what());
+	}
+}
+
+bool liblec::lecnet::tcp::server_async::send(const client_address& address,
+	const std::string& data) {
+	// nothing to send, or too much for a single frame
+	if (data.empty() || !frame_header::fits(data.length()))
+		return false;
+
+	try {
+		bool found = false;
+		auto p_session = _d._clients.find(address, found);
+
+		if (!p_session)
+			return false;
+
+		p_session->push(_d.make_push(data));
+		return true;
+	}
+	catch (std::exception& e) {
+		_d.log(e.what());
+		return false;
+	}
+}
+
+size_t liblec::lecnet::tcp::server_async::broadcast(const std::string& data) {
+	// nothing to send, or too much for a single frame
+	if (data.empty() || !frame_header::fits(data.length()))
+		return 0;
+
+	try {
+		std::vector<std::shared_ptr<_session_async>> sessions;
+		_d._clients.sessions(sessions);
+
+		if (sessions.empty())
+			return 0;
+
+		// every client gets the same frames
+		const auto frames = _d.make_push(data);
+
+		for (auto& p_session : sessions)
+			p_session->push(frames);
+
+		return sessions.size();
 	}
 	catch (std::exception& e) {
 		_d.log(e.what());
+		return 0;
 	}
 }
 
@@ -425,21 +1916,18 @@ void liblec::lecnet::tcp::server_async::close() {
 	bool log_this = false;
 
 	try {
-		liblec::auto_mutex lock(_d._clients_lock);
-
-		if (!_d._clients.empty())
+		if (_d._clients.size())
 			log_this = true;
 
 		if (log_this)
 			_d.log(server_log::close());
 
-		// iterate through map and close client sockets
-		for (auto const& it : _d._clients) {
-			boost::asio::ip::tcp::socket* p_socket =
-				(boost::asio::ip::tcp::socket*)(_d._clients[it.first].p_socket_internal);
-			p_socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-			p_socket->close();
-		}
+		std::vector<std::shared_ptr<_session_async>> sessions;
+		_d._clients.sessions(sessions);
+
+		// close client sockets
+		for (auto& p_session : sessions)
+			p_session->close();
 	}
 	catch (std::exception& e) {
 		_d.log(e.what());
@@ -447,13 +1935,7 @@ void liblec::lecnet::tcp::server_async::close() {
 	}
 
 	// wait for all clients to actually get disconnected
-	while (true) {
-		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
-
-		liblec::auto_mutex lock(_d._clients_lock);
-		if (!_d._clients.size())
-			break;
-	}
+	_d._clients.wait_empty();
 
 	if (log_this)
 		_d.log(server_log::closed());
@@ -464,12 +1946,11 @@ bool liblec::lecnet::tcp::server_async::stop() {
 		close();
 
 		if (running()) {
-			// stop the io_service
-			_d._p_io_service->stop();
+			// stop the io services
+			_d.stop_io();
 
 			// wait for server to stop running
-			while (running())
-				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			_d._fut.wait();
 
 			_d.log(server_log::stop());
 		}
@@ -481,15 +1962,66 @@ bool liblec::lecnet::tcp::server_async::stop() {
 	return true;
 }
 
+bool liblec::lecnet::tcp::server_async::drain(const long& timeout_seconds) {
+	bool drained = true;
+
+	try {
+		if (running()) {
+			_d.log(server_log::drain());
+
+			// refuse new clients; those accepted meanwhile see the flag and close right away
+			_d._draining = true;
+			_d.stop_accepting();
+
+			std::vector<std::shared_ptr<_session_async>> sessions;
+			_d._clients.sessions(sessions);
+
+			for (auto& p_session : sessions)
+				p_session->drain();
+
+			// the sessions must not be kept alive from here
+			sessions.clear();
+
+			drained = _d._clients.wait_empty(std::chrono::seconds(std::max(timeout_seconds,
+				0L)));
+
+			if (drained)
+				_d.log(server_log::drained());
+			else
+				_d.log(server_log::drain_timeout(std::to_string(_d._clients.size())));
+		}
+	}
+	catch (std::exception& e) {
+		_d.log(e.what());
+	}
+
+	stop();
+	return drained;
+}
+
 void liblec::lecnet::tcp::server_async::get_client_info(std::vector<client_info>& client_info) {
-	liblec::auto_mutex lock(_d._clients_lock);
-	client_info.clear();
-	client_info.reserve(_d._clients.size());
-	for (auto const& it : _d._clients)
-		client_info.push_back(it.second.client_info);
+	_d._clients.get_client_info(client_info);
 }
 
 void liblec::lecnet::tcp::server_async::traffic(liblec::lecnet::network_traffic& traffic) {
-	liblec::auto_mutex lock(_d._clients_lock);
-	traffic = _d._total_traffic;
+	_d._clients.traffic(traffic);
+}
+
+void liblec::lecnet::tcp::server_async::get_worker_queue_depths(std::vector<size_t>& depths) {
+	_d._workers.queue_depths(depths);
+}
+
+void liblec::lecnet::tcp::server_async::on_receive(const connection& conn,
+	std::string_view data_received,
+	response_writer& response) {
+	response.write(on_receive(conn.address, std::string(data_received)));
+}
+
+void liblec::lecnet::tcp::server_async::on_receive_async(const connection& conn,
+	std::string data_received,
+	pending_response response) {
+	std::string payload;
+	response_writer writer(payload);
+	on_receive(conn, data_received, writer);
+	response.send(std::move(payload));
 }
@@ -0,0 +1,107 @@
+//
+// timer_wheel.cpp - server timer wheel implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+timer_wheel::timer_wheel(std::chrono::milliseconds tick,
+	size_t slots) :
+	_tick(std::max(tick, std::chrono::milliseconds(1))),
+	_start(clock::now()),
+	_slots(std::max(slots, size_t(2))) {}
+
+std::chrono::milliseconds timer_wheel::tick() const {
+	return _tick;
+}
+
+unsigned long long timer_wheel::to_tick(clock::time_point time,
+	bool round_up) const {
+	if (time <= _start)
+		return 0;
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(time - _start);
+	unsigned long long tick = elapsed / _tick;
+
+	if (round_up && elapsed % _tick != std::chrono::milliseconds(0))
+		tick++;
+
+	return tick;
+}
+
+void timer_wheel::insert(const std::shared_ptr<timer>& p_timer,
+	unsigned long long tick) {
+	// never behind the wheel, and never more than one turn ahead of it
+	tick = std::max(tick, _current + 1);
+	tick = std::min(tick, _current + _slots.size() - 1);
+
+	p_timer->_scheduled = tick;
+	_slots[tick % _slots.size()].push_back(p_timer);
+}
+
+void timer_wheel::arm(const std::shared_ptr<timer>& p_timer,
+	clock::time_point deadline) {
+	const unsigned long long tick = std::max(to_tick(deadline, true), 1ULL);
+
+	std::lock_guard<std::mutex> lock(_lock);
+	p_timer->_deadline = tick;
+
+	// a later deadline is picked up when the timer's current slot comes round; only an earlier
+	// one needs the timer in another slot (the old entry is then skipped as stale)
+	if (p_timer->_scheduled == 0 || tick < p_timer->_scheduled)
+		insert(p_timer, tick);
+}
+
+void timer_wheel::cancel(const std::shared_ptr<timer>& p_timer) {
+	std::lock_guard<std::mutex> lock(_lock);
+	p_timer->_deadline = 0;
+}
+
+void timer_wheel::advance(clock::time_point now) {
+	const unsigned long long now_tick = to_tick(now, false);
+	std::vector<std::shared_ptr<timer>> expired;
+
+	// it's essential to limit the scope of this mutex
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		while (_current < now_tick) {
+			_current++;
+
+			std::vector<std::weak_ptr<timer>> slot;
+			slot.swap(_slots[_current % _slots.size()]);
+
+			for (auto& it : slot) {
+				auto p_timer = it.lock();
+
+				// destroyed, or a stale entry left behind when the timer was moved
+				if (!p_timer || p_timer->_scheduled != _current)
+					continue;
+
+				p_timer->_scheduled = 0;
+
+				if (p_timer->_deadline == 0)
+					continue;
+
+				if (p_timer->_deadline <= _current) {
+					p_timer->_deadline = 0;
+					expired.push_back(p_timer);
+				}
+				else
+					insert(p_timer, p_timer->_deadline);
+			}
+		}
+	}
+
+	// call the handlers outside the lock, as they may well re-arm their timers
+	for (auto& p_timer : expired)
+		if (p_timer->on_expire)
+			p_timer->on_expire();
+}
@@ -0,0 +1,98 @@
+//
+// timer_wheel.h - server timer wheel interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// A hashed timer wheel for the timeouts of many connections.
+/// </summary>
+///
+/// <remarks>
+/// Time is split into ticks and each timer sits in the slot of the tick it is due in (modulo the
+/// number of slots), so arming a timer and checking a tick for expired timers both take constant
+/// time however many timers there are. Pushing a deadline back doesn't move the timer; when its
+/// slot comes round it is simply put in the slot of its new deadline, which is what keeps
+/// frequent re-arming (on every read) cheap. The wheel is driven by calling
+/// <see cref="advance"/> once per tick. Thread safe.
+/// </remarks>
+class timer_wheel {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	/// <summary>
+	/// A timer, owned by whoever arms it. The wheel only keeps a weak reference to it, so a
+	/// timer that is destroyed is simply dropped.
+	/// </summary>
+	struct timer {
+		/// <summary>
+		/// Called from <see cref="advance"/> when the timer expires.
+		/// </summary>
+		std::function<void()> on_expire;
+
+	private:
+		friend timer_wheel;
+
+		// guarded by the wheel's lock; 0 means not armed / not in a slot
+		unsigned long long _deadline = 0;
+		unsigned long long _scheduled = 0;
+	};
+
+	/// <param name="tick">
+	/// The resolution of the wheel.
+	/// </param>
+	///
+	/// <param name="slots">
+	/// The number of slots. Timers due more than one turn of the wheel away are looked at once
+	/// per turn until they are due.
+	/// </param>
+	timer_wheel(std::chrono::milliseconds tick = std::chrono::milliseconds(250),
+		size_t slots = 512);
+
+	/// <summary>
+	/// Get the resolution of the wheel.
+	/// </summary>
+	std::chrono::milliseconds tick() const;
+
+	/// <summary>
+	/// Arm a timer, or change its deadline if it's already armed.
+	/// </summary>
+	void arm(const std::shared_ptr<timer>& p_timer,
+		clock::time_point deadline);
+
+	/// <summary>
+	/// Disarm a timer.
+	/// </summary>
+	void cancel(const std::shared_ptr<timer>& p_timer);
+
+	/// <summary>
+	/// Move the wheel on to the given time, calling on_expire for every timer that has expired.
+	/// </summary>
+	void advance(clock::time_point now);
+
+private:
+	unsigned long long to_tick(clock::time_point time, bool round_up) const;
+	void insert(const std::shared_ptr<timer>& p_timer, unsigned long long tick);
+
+	const std::chrono::milliseconds _tick;
+	const clock::time_point _start;
+
+	std::mutex _lock;
+	std::vector<std::vector<std::weak_ptr<timer>>> _slots;
+	unsigned long long _current = 0;
+
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel& operator=(const timer_wheel&) = delete;
+};
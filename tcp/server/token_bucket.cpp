@@ -0,0 +1,51 @@
+//
+// token_bucket.cpp - server token bucket implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "token_bucket.h"
+
+#include <algorithm>
+
+token_bucket::token_bucket(double rate,
+	double size) :
+	_rate(rate),
+	_size(std::max(size, 1.0)),
+	_tokens(_size),
+	_last(clock::now()) {}
+
+void token_bucket::set_rate(double rate,
+	double size) {
+	std::lock_guard<std::mutex> lock(_lock);
+	_rate = rate;
+	_size = std::max(size, 1.0);
+	_tokens = _size;
+	_last = clock::now();
+}
+
+token_bucket::clock::duration token_bucket::take() {
+	std::lock_guard<std::mutex> lock(_lock);
+
+	if (_rate <= 0)
+		return clock::duration::zero();
+
+	// top the bucket up for the time since it was last looked at
+	const auto now = clock::now();
+	const std::chrono::duration<double> elapsed = now - _last;
+	_tokens = std::min(_size, _tokens + elapsed.count() * _rate);
+	_last = now;
+
+	if (_tokens >= 1) {
+		_tokens -= 1;
+		return clock::duration::zero();
+	}
+
+	const std::chrono::duration<double> wait((1 - _tokens) / _rate);
+	return std::max(std::chrono::duration_cast<clock::duration>(wait),
+		clock::duration(1));
+}
@@ -0,0 +1,60 @@
+//
+// token_bucket.h - server token bucket interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+/// <summary>
+/// A token bucket, for limiting how often something can happen. Thread safe.
+/// </summary>
+///
+/// <remarks>
+/// Tokens are added at a steady rate up to the size of the bucket, and every event takes one.
+/// Events can therefore come in bursts as large as the bucket, but on average no faster than
+/// the rate.
+/// </remarks>
+class token_bucket {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	/// <param name="rate">
+	/// The number of tokens added per second, or 0 for no limit.
+	/// </param>
+	///
+	/// <param name="size">
+	/// The number of tokens the bucket holds; it starts full.
+	/// </param>
+	token_bucket(double rate = 0,
+		double size = 1);
+
+	void set_rate(double rate,
+		double size);
+
+	/// <summary>
+	/// Take a token.
+	/// </summary>
+	///
+	/// <returns>
+	/// Returns zero if a token was taken, else how long it will be until one can be.
+	/// </returns>
+	clock::duration take();
+
+private:
+	std::mutex _lock;
+	double _rate;
+	double _size;
+	double _tokens;
+	clock::time_point _last;
+
+	token_bucket(const token_bucket&) = delete;
+	token_bucket& operator=(const token_bucket&) = delete;
+};
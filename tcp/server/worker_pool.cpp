@@ -0,0 +1,155 @@
+//
+// worker_pool.cpp - server worker pool implementation
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#include "worker_pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class worker_pool::impl {
+public:
+	struct alignas(64) queue {
+		std::mutex lock;
+		std::condition_variable cv;
+		std::deque<task> tasks;
+		std::vector<task> waiting;	// called once the queue has room
+		bool stopping = false;
+		std::thread thread;
+	};
+
+	static void worker_func(queue* p_queue,
+		size_t capacity) {
+		while (true) {
+			task t;
+			std::vector<task> waiting;
+
+			// it's essential to limit the scope of this lock
+			{
+				std::unique_lock<std::mutex> lock(p_queue->lock);
+				p_queue->cv.wait(lock, [p_queue]() {
+					return p_queue->stopping || !p_queue->tasks.empty();
+				});
+
+				if (p_queue->stopping)
+					break;
+
+				t = std::move(p_queue->tasks.front());
+				p_queue->tasks.pop_front();
+
+				if (p_queue->tasks.size() < capacity)
+					waiting.swap(p_queue->waiting);
+			}
+
+			// tell those that were turned away that there's room, outside the lock
+			for (auto& it : waiting)
+				it();
+
+			try {
+				t();
+			}
+			catch (std::exception&) {
+				// a task is responsible for reporting its own errors
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<queue>> _queues;
+	std::mutex _queues_lock;
+	size_t _capacity = 0;
+};
+
+worker_pool::worker_pool() :
+	_d(*(new impl)) {}
+
+worker_pool::~worker_pool() {
+	stop();
+	delete& _d;
+}
+
+void worker_pool::start(size_t workers,
+	size_t capacity) {
+	stop();
+
+	std::lock_guard<std::mutex> lock(_d._queues_lock);
+	_d._capacity = capacity;
+
+	for (size_t i = 0; i < workers; i++) {
+		_d._queues.push_back(std::make_unique<impl::queue>());
+		_d._queues.back()->thread = std::thread(impl::worker_func, _d._queues.back().get(),
+			capacity);
+	}
+}
+
+void worker_pool::stop() {
+	std::vector<std::unique_ptr<impl::queue>> queues;
+
+	// it's essential to limit the scope of this lock
+	{
+		std::lock_guard<std::mutex> lock(_d._queues_lock);
+		queues.swap(_d._queues);
+	}
+
+	for (auto& p_queue : queues) {
+		std::lock_guard<std::mutex> lock(p_queue->lock);
+		p_queue->stopping = true;
+		p_queue->cv.notify_one();
+	}
+
+	for (auto& p_queue : queues) {
+		if (p_queue->thread.joinable())
+			p_queue->thread.join();
+	}
+
+	// with the workers gone no lock is needed
+	for (auto& p_queue : queues) {
+		for (auto& it : p_queue->waiting)
+			it();
+	}
+
+	// the tasks that did not start are discarded here, outside the locks (they may own
+	// sessions whose destructors have work of their own to do)
+}
+
+bool worker_pool::running() {
+	std::lock_guard<std::mutex> lock(_d._queues_lock);
+	return !_d._queues.empty();
+}
+
+bool worker_pool::post(unsigned long long key,
+	task& t,
+	task on_room) {
+	impl::queue& q = *_d._queues[key % _d._queues.size()];
+
+	std::lock_guard<std::mutex> lock(q.lock);
+
+	if (q.tasks.size() >= _d._capacity) {
+		q.waiting.push_back(std::move(on_room));
+		return false;
+	}
+
+	q.tasks.push_back(std::move(t));
+	q.cv.notify_one();
+	return true;
+}
+
+void worker_pool::queue_depths(std::vector<size_t>& depths) {
+	std::lock_guard<std::mutex> lock(_d._queues_lock);
+
+	depths.clear();
+	depths.reserve(_d._queues.size());
+
+	for (auto& p_queue : _d._queues) {
+		std::lock_guard<std::mutex> lock(p_queue->lock);
+		depths.push_back(p_queue->tasks.size());
+	}
+}
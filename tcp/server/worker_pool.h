@@ -0,0 +1,96 @@
+//
+// worker_pool.h - server worker pool interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+/// <summary>
+/// A pool of worker threads, each with its own queue, for running work off the I/O threads.
+/// </summary>
+///
+/// <remarks>
+/// Work is queued by key and work with the same key always goes to the same worker, so it runs
+/// in the order it was posted. A queue never holds more than its capacity; work that doesn't fit
+/// is turned away, and the caller is told when there is room for it.
+/// </remarks>
+class worker_pool {
+public:
+	typedef std::function<void()> task;
+
+	worker_pool();
+	~worker_pool();
+
+	/// <summary>
+	/// Start the worker threads.
+	/// </summary>
+	///
+	/// <param name="workers">
+	/// The number of worker threads, each with its own queue.
+	/// </param>
+	///
+	/// <param name="capacity">
+	/// The number of tasks a queue can hold.
+	/// </param>
+	void start(size_t workers,
+		size_t capacity);
+
+	/// <summary>
+	/// Stop the worker threads. Tasks that have not started are discarded, and the callers
+	/// waiting for room are told, with <see cref="running"/> returning false from then on.
+	/// </summary>
+	void stop();
+
+	/// <summary>
+	/// Check whether the pool has any worker threads.
+	/// </summary>
+	bool running();
+
+	/// <summary>
+	/// Queue a task.
+	/// </summary>
+	///
+	/// <param name="key">
+	/// The key that selects the worker's queue, e.g. a connection ID.
+	/// </param>
+	///
+	/// <param name="t">
+	/// The task. It is moved from if it is queued, and left as it is otherwise.
+	/// </param>
+	///
+	/// <param name="on_room">
+	/// Called once if the queue is at capacity, as soon as it has room again (or the pool is
+	/// stopped). It is called from a worker thread, or from the thread that stops the pool.
+	/// </param>
+	///
+	/// <returns>
+	/// Returns true if the task was queued, else false if the queue is at capacity.
+	/// </returns>
+	///
+	/// <remarks>
+	/// Only call this between <see cref="start"/> and <see cref="stop"/>.
+	/// </remarks>
+	bool post(unsigned long long key,
+		task& t,
+		task on_room);
+
+	/// <summary>
+	/// Get the number of tasks waiting in each worker's queue.
+	/// </summary>
+	void queue_depths(std::vector<size_t>& depths);
+
+private:
+	class impl;
+	impl& _d;
+
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+};
@@ -14,6 +14,7 @@
 
 #include "../tcp.h"
 #include "../helper_fxns/helper_fxns.h"
+#include "frame/frame_compression.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 #define ASIO_STANDALONE
@@ -73,3 +74,90 @@ void liblec::lecnet::tcp::get_host_ips(std::vector<std::string>& ips) {
 	// sort alphabetically
 	std::sort(ips.begin(), ips.end(), compare_no_case);
 }
+
+bool liblec::lecnet::tcp::compression_supported(compression codec) {
+	return frame_compression::supported(codec);
+}
+
+bool liblec::lecnet::tcp::train_compression_dictionary(const std::vector<std::string>& samples,
+	size_t capacity,
+	std::string& dictionary,
+	std::string& error) {
+	return frame_compression::train(samples, capacity, dictionary, error);
+}
+
+liblec::lecnet::tcp::server::response_writer::response_writer(std::string& payload) :
+	_payload(payload) {}
+
+void liblec::lecnet::tcp::server::response_writer::reserve(size_t length) {
+	_payload.reserve(length);
+}
+
+void liblec::lecnet::tcp::server::response_writer::write(const char* data,
+	size_t length) {
+	_payload.append(data, length);
+}
+
+void liblec::lecnet::tcp::server::response_writer::write(std::string_view data) {
+	_payload.append(data.data(), data.length());
+}
+
+size_t liblec::lecnet::tcp::server::response_writer::length() const {
+	return _payload.length();
+}
+
+class liblec::lecnet::tcp::server::pending_response::impl {
+public:
+	std::function<void(std::string payload)> on_send;
+};
+
+liblec::lecnet::tcp::server::pending_response::pending_response(
+	std::function<void(std::string payload)> on_send) :
+	_p_d(new impl) {
+	_p_d->on_send = std::move(on_send);
+}
+
+liblec::lecnet::tcp::server::pending_response::pending_response(
+	pending_response&& other) noexcept :
+	_p_d(other._p_d) {
+	other._p_d = nullptr;
+}
+
+liblec::lecnet::tcp::server::pending_response&
+liblec::lecnet::tcp::server::pending_response::operator=(pending_response&& other) noexcept {
+	if (this != &other) {
+		// the response being replaced is sent empty, as the destructor would
+		try {
+			send(std::string());
+		}
+		catch (std::exception&) {}
+
+		delete _p_d;
+		_p_d = other._p_d;
+		other._p_d = nullptr;
+	}
+
+	return *this;
+}
+
+liblec::lecnet::tcp::server::pending_response::~pending_response() {
+	try {
+		send(std::string());
+	}
+	catch (std::exception&) {}
+
+	delete _p_d;
+}
+
+void liblec::lecnet::tcp::server::pending_response::send(std::string data) {
+	if (!pending())
+		return;
+
+	auto on_send = std::move(_p_d->on_send);
+	_p_d->on_send = nullptr;
+	on_send(std::move(data));
+}
+
+bool liblec::lecnet::tcp::server::pending_response::pending() const {
+	return _p_d && _p_d->on_send;
+}
@@ -0,0 +1,253 @@
+//
+// tcp_coroutine.h - tcp/ip C++20 coroutine interface
+//
+// lecnet network library, part of the liblec library
+// Copyright (c) 2018 Alec Musasa (alecmus at live dot com)
+//
+// Released under the MIT license. For full details see the
+// file LICENSE.txt
+//
+
+#pragma once
+
+#include "tcp.h"
+
+// only for C++20 code; the library itself doesn't need it
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace liblec {
+	namespace lecnet {
+		namespace tcp {
+			template <typename T = void>
+			class task;
+
+			namespace coroutine_detail {
+				/// <summary>
+				/// Resumes whichever coroutine awaited a task once the task is done.
+				/// </summary>
+				struct final_awaiter {
+					bool await_ready() noexcept { return false; }
+
+					template <typename promise_type>
+					std::coroutine_handle<> await_suspend(
+						std::coroutine_handle<promise_type> coroutine) noexcept {
+						// straight to the awaiting coroutine, without growing the stack
+						auto continuation = coroutine.promise().continuation();
+						return continuation ? continuation : std::noop_coroutine();
+					}
+
+					void await_resume() noexcept {}
+				};
+
+				/// <summary>
+				/// What the promises of every kind of task have in common: resuming whichever
+				/// coroutine awaited the task once it's done, and keeping the exception it
+				/// ended with, if any.
+				/// </summary>
+				class task_promise_base {
+				public:
+					std::suspend_always initial_suspend() noexcept { return {}; }
+					final_awaiter final_suspend() noexcept { return {}; }
+
+					void unhandled_exception() { _exception = std::current_exception(); }
+
+					void set_continuation(std::coroutine_handle<> continuation) {
+						_continuation = continuation;
+					}
+
+					std::coroutine_handle<> continuation() const { return _continuation; }
+
+				protected:
+					void rethrow() {
+						if (_exception)
+							std::rethrow_exception(_exception);
+					}
+
+				private:
+					std::coroutine_handle<> _continuation;
+					std::exception_ptr _exception;
+				};
+
+				template <typename T>
+				class task_promise : public task_promise_base {
+				public:
+					task<T> get_return_object();
+
+					template <typename value_type>
+					void return_value(value_type&& value) {
+						_value.emplace(std::forward<value_type>(value));
+					}
+
+					T result() {
+						rethrow();
+						return std::move(*_value);
+					}
+
+				private:
+					std::optional<T> _value;
+				};
+
+				template <>
+				class task_promise<void> : public task_promise_base {
+				public:
+					task<void> get_return_object();
+
+					void return_void() {}
+					void result() { rethrow(); }
+				};
+
+				/// <summary>
+				/// The coroutine type of a coroutine that is started and left to run on its
+				/// own. It ends quietly if there's an exception.
+				/// </summary>
+				struct detached {
+					struct promise_type {
+						detached get_return_object() noexcept { return {}; }
+						std::suspend_never initial_suspend() noexcept { return {}; }
+						std::suspend_never final_suspend() noexcept { return {}; }
+						void return_void() noexcept {}
+						void unhandled_exception() noexcept {}
+					};
+				};
+			}
+
+			/// <summary>
+			/// The coroutine type of a coroutine that returns a T, e.g. the one handling a
+			/// client's data in <see cref="server_coroutines"/>.
+			/// </summary>
+			///
+			/// <remarks>
+			/// The coroutine only starts once the task is co_awaited, and the awaiting coroutine
+			/// is resumed with the result, or the exception the coroutine ended with, on
+			/// whichever thread the coroutine ends on.
+			/// </remarks>
+			template <typename T>
+			class task {
+			public:
+				typedef coroutine_detail::task_promise<T> promise_type;
+
+				explicit task(std::coroutine_handle<promise_type> coroutine) :
+					_coroutine(coroutine) {}
+
+				task(task&& other) noexcept :
+					_coroutine(std::exchange(other._coroutine, nullptr)) {}
+
+				task& operator=(task&& other) noexcept {
+					if (this != &other) {
+						if (_coroutine)
+							_coroutine.destroy();
+
+						_coroutine = std::exchange(other._coroutine, nullptr);
+					}
+
+					return *this;
+				}
+
+				~task() {
+					if (_coroutine)
+						_coroutine.destroy();
+				}
+
+				auto operator co_await() && noexcept {
+					struct awaiter {
+						std::coroutine_handle<promise_type> coroutine;
+
+						bool await_ready() noexcept { return !coroutine || coroutine.done(); }
+
+						std::coroutine_handle<> await_suspend(
+							std::coroutine_handle<> awaiting) noexcept {
+							coroutine.promise().set_continuation(awaiting);
+							return coroutine;
+						}
+
+						T await_resume() { return coroutine.promise().result(); }
+					};
+
+					return awaiter{ _coroutine };
+				}
+
+			private:
+				std::coroutine_handle<promise_type> _coroutine;
+
+				task(const task&) = delete;
+				task& operator=(const task&) = delete;
+			};
+
+			template <typename T>
+			task<T> coroutine_detail::task_promise<T>::get_return_object() {
+				return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+			}
+
+			inline task<void> coroutine_detail::task_promise<void>::get_return_object() {
+				return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+			}
+
+			/// <summary>
+			/// A server whose data handler is a coroutine, for responses that wait on other
+			/// things, e.g. requests to other servers, without holding up a thread in the
+			/// meantime. Derive from server_coroutines&lt;server_async&gt; or
+			/// server_coroutines&lt;server_async_ssl&gt; and implement
+			/// <see cref="on_receive_coroutine"/>.
+			/// </summary>
+			///
+			/// <remarks>
+			/// server_params::asynchronous_handlers is always set when the server is started.
+			/// The handler is started on the thread that would have called on_receive(), and
+			/// the response is sent from whichever thread it co_returns on.
+			/// </remarks>
+			template <class server_type>
+			class server_coroutines : public server_type {
+			public:
+				bool start(const server::server_params& params) override {
+					server::server_params coroutine_params = params;
+					coroutine_params.asynchronous_handlers = true;
+					return server_type::start(coroutine_params);
+				}
+
+				/// <summary>
+				/// Called whenever data is received.
+				/// </summary>
+				///
+				/// <param name="conn">
+				/// The client's connection.
+				/// </param>
+				///
+				/// <param name="data_received">
+				/// The data received from the client.
+				/// </param>
+				///
+				/// <returns>
+				/// The data to send back to the client, if any. Nothing is sent back if the
+				/// coroutine ends with an exception.
+				/// </returns>
+				///
+				/// <remarks>
+				/// Can be running for any number of clients at the same time, on any of the
+				/// server's threads, so it must be thread safe.
+				/// </remarks>
+				virtual task<std::string> on_receive_coroutine(const server::connection& conn,
+					std::string data_received) = 0;
+
+				void on_receive_async(const server::connection& conn,
+					std::string data_received,
+					server::pending_response response) override {
+					respond(conn, std::move(data_received), std::move(response));
+				}
+
+			private:
+				coroutine_detail::detached respond(server::connection conn,
+					std::string data_received,
+					server::pending_response response) {
+					response.send(co_await on_receive_coroutine(conn, std::move(data_received)));
+				}
+			};
+		}
+	}
+}
+
+#endif
@@ -138,8 +138,11 @@ public:
 	}
 
 	void stop() {
-		if (_socket.is_open())
-			_deadline.expires_from_now(boost::posix_time::milliseconds(0));
+		// the deadline is only ever touched from the thread running the io_service
+		_io_service->post([this]() {
+			if (_socket.is_open())
+				_deadline.expires_from_now(boost::posix_time::milliseconds(0));
+		});
 	}
 
 private:
@@ -246,6 +249,8 @@ public:
 private:
 	std::future<void> _fut;
 	_broadcast_client* _p_current_broadcast_client;
+	bool _stopping = false;
+	liblec::mutex _client_lock;
 
 	unsigned short _port;
 	std::string _broadcast_address;
@@ -285,13 +290,25 @@ void liblec::lecnet::udp::broadcast::receiver::receiver_impl::receiver_func(
 			p_current->_d->_port,
 			p_current->_d->_timeout_milliseconds);
 
-		p_current->_d->_p_current_broadcast_client = &client;
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(p_current->_d->_client_lock);
+			p_current->_d->_p_current_broadcast_client = &client;
+
+			// stop() was called before there was a client to stop
+			if (p_current->_d->_stopping)
+				client.stop();
+		}
 
 		// run the client
 		std::string message, error;
 		bool result = client.receive(message, error);
 
-		p_current->_d->_p_current_broadcast_client = nullptr;
+		// it's essential to limit the scope of this mutex
+		{
+			liblec::auto_mutex lock(p_current->_d->_client_lock);
+			p_current->_d->_p_current_broadcast_client = nullptr;
+		}
 
 		// only here can _result be changed to true. Only here. This is absolutely important.
 		liblec::auto_mutex lock(p_current->_d->_result_lock);
@@ -316,6 +333,12 @@ bool liblec::lecnet::udp::broadcast::receiver::run(long long timeout_millisecond
 
 	_d->_timeout_milliseconds = timeout_milliseconds;
 
+	// it's essential to limit the scope of this mutex
+	{
+		liblec::auto_mutex lock(_d->_client_lock);
+		_d->_stopping = false;
+	}
+
 	try {
 		// run receiver task asynchronously
 		_d->_fut = std::async(std::launch::async,
@@ -356,12 +379,17 @@ bool liblec::lecnet::udp::broadcast::receiver::get(std::string& message,
 void liblec::lecnet::udp::broadcast::receiver::stop() {
 	try {
 		if (running()) {
-			if (_d->_p_current_broadcast_client)
-				_d->_p_current_broadcast_client->stop();	// to-do: make this safer
+			// it's essential to limit the scope of this mutex
+			{
+				liblec::auto_mutex lock(_d->_client_lock);
+				_d->_stopping = true;
+
+				if (_d->_p_current_broadcast_client)
+					_d->_p_current_broadcast_client->stop();
+			}
 
 			// wait for receiver to stop running
-			while (running())
-				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			_d->_fut.wait();
 		}
 	}
 	catch (std::exception&) {}